@@ -0,0 +1,209 @@
+#include "BakedWorld.h"
+
+#include <algorithm>
+#include <filesystem>
+#include <istream>
+#include <sstream>
+
+namespace godot {
+
+namespace {
+constexpr char MAGIC[4] = {'V', 'X', 'B', 'K'};
+constexpr uint32_t VERSION = 1;
+
+template <typename T>
+void write_value(std::ostream &out, const T &value) {
+  out.write(reinterpret_cast<const char *>(&value), sizeof(T));
+}
+
+template <typename T>
+bool read_value(std::istream &in, T *value) {
+  in.read(reinterpret_cast<char *>(value), sizeof(T));
+  return bool(in);
+}
+
+/**
+ * @brief Reads a range of memory as a stream, without copying it.
+ */
+class MemoryBuffer : public std::streambuf {
+ public:
+  MemoryBuffer(const char *begin, const char *end) {
+    // The get area is only read from
+    setg(const_cast<char *>(begin), const_cast<char *>(begin),
+         const_cast<char *>(end));
+  }
+};
+}  // namespace
+
+bool BakedWorld::open(const std::string &path) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  _file.open(path, std::ios::in | std::ios::binary);
+  if (!_file || !read_header()) {
+    _file.close();
+    return false;
+  }
+  index_records();
+
+  // The workers read the records from memory concurrently
+  _file.seekg(0, std::ios::end);
+  _data.resize(size_t(_file.tellg()));
+  _file.seekg(0);
+  _file.read(_data.data(), _data.size());
+  bool loaded = bool(_file);
+  _file.close();
+  if (!loaded) {
+    _index.clear();
+    _data.clear();
+  }
+  return loaded;
+}
+
+bool BakedWorld::open_for_append(const std::string &path,
+                                 const Settings &settings) {
+  std::lock_guard<std::mutex> lock(_mutex);
+  if (!std::filesystem::exists(path)) {
+    std::ofstream(path, std::ios::binary);
+  }
+  _file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+  if (!_file) {
+    return false;
+  }
+
+  _file.seekg(0, std::ios::end);
+  if (_file.tellg() == 0) {
+    _settings = settings;
+    write_header();
+    _file.flush();
+    return bool(_file);
+  }
+
+  _file.seekg(0);
+  if (!read_header() || !(_settings == settings)) {
+    _file.close();
+    return false;
+  }
+  std::streamoff end = index_records();
+  // Drop the tail an interrupted bake left behind
+  _file.close();
+  std::error_code error;
+  std::filesystem::resize_file(path, end, error);
+  if (error) {
+    return false;
+  }
+  _file.open(path, std::ios::in | std::ios::out | std::ios::binary);
+  return bool(_file);
+}
+
+const BakedWorld::Settings &BakedWorld::settings() const { return _settings; }
+
+size_t BakedWorld::size() const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _index.size();
+}
+
+bool BakedWorld::contains(int64_t x, int64_t y, int64_t z) const {
+  std::lock_guard<std::mutex> lock(_mutex);
+  return _index.count(Coord{x, y, z}) > 0;
+}
+
+bool BakedWorld::read(int64_t x, int64_t y, int64_t z,
+                      VoxelStorage *voxels) const {
+  if (_data.empty()) {
+    return false;
+  }
+  auto it = _index.find(Coord{x, y, z});
+  if (it == _index.end()) {
+    return false;
+  }
+  MemoryBuffer buffer(_data.data() + it->second, _data.data() + _data.size());
+  std::istream in(&buffer);
+  return voxels->read(in);
+}
+
+size_t BakedWorld::memory_usage() const { return _data.capacity(); }
+
+bool BakedWorld::append(int64_t x, int64_t y, int64_t z,
+                        const VoxelStorage &voxels) {
+  // Serialize outside of the lock, the workers only wait for the write
+  std::ostringstream record;
+  write_value(record, int32_t(x));
+  write_value(record, int32_t(y));
+  write_value(record, int32_t(z));
+  std::ostringstream payload;
+  voxels.write(payload);
+  std::string data = payload.str();
+  write_value(record, uint32_t(data.size()));
+  record << data;
+  std::string bytes = record.str();
+
+  std::lock_guard<std::mutex> lock(_mutex);
+  _file.seekp(0, std::ios::end);
+  std::streamoff offset = std::streamoff(_file.tellp()) +
+                          std::streamoff(bytes.size() - data.size());
+  _file.write(bytes.data(), bytes.size());
+  // Every record reaches the disk whole before the next one starts
+  _file.flush();
+  if (!_file) {
+    return false;
+  }
+  _index[Coord{x, y, z}] = offset;
+  return true;
+}
+
+bool BakedWorld::read_header() {
+  char magic[sizeof(MAGIC)];
+  uint32_t version;
+  uint8_t density;
+  _file.read(magic, sizeof(magic));
+  if (!_file || !std::equal(magic, magic + sizeof(MAGIC), MAGIC) ||
+      !read_value(_file, &version) || version != VERSION ||
+      !read_value(_file, &_settings.seed) ||
+      !read_value(_file, &_settings.generator) ||
+      !read_value(_file, &_settings.divisions) ||
+      !read_value(_file, &_settings.chunk_size) ||
+      !read_value(_file, &density)) {
+    return false;
+  }
+  _settings.density = density != 0;
+  return true;
+}
+
+void BakedWorld::write_header() {
+  _file.write(MAGIC, sizeof(MAGIC));
+  write_value(_file, VERSION);
+  write_value(_file, _settings.seed);
+  write_value(_file, _settings.generator);
+  write_value(_file, _settings.divisions);
+  write_value(_file, _settings.chunk_size);
+  write_value(_file, uint8_t(_settings.density));
+}
+
+std::streamoff BakedWorld::index_records() {
+  // The coordinates and the length of the VoxelStorage
+  constexpr std::streamoff RECORD_HEADER =
+      3 * sizeof(int32_t) + sizeof(uint32_t);
+
+  _index.clear();
+  std::streamoff end = _file.tellg();
+  _file.seekg(0, std::ios::end);
+  std::streamoff file_size = _file.tellg();
+  _file.seekg(end);
+  while (end + RECORD_HEADER <= file_size) {
+    int32_t x, y, z;
+    uint32_t length;
+    read_value(_file, &x);
+    read_value(_file, &y);
+    read_value(_file, &z);
+    read_value(_file, &length);
+    std::streamoff offset = end + RECORD_HEADER;
+    if (!_file || offset + std::streamoff(length) > file_size) {
+      break;
+    }
+    _index[Coord{x, y, z}] = offset;
+    end = offset + length;
+    _file.seekg(end);
+  }
+  _file.clear();
+  return end;
+}
+}  // namespace godot
@@ -0,0 +1,124 @@
+#ifndef BAKEDWORLD_H
+#define BAKEDWORLD_H
+
+#include <cstdint>
+#include <fstream>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include "VoxelStorage.h"
+
+namespace godot {
+
+/**
+ * @brief A file of pregenerated chunk voxels, written by the voxelbake tool
+ * and loaded by Terrain instead of generating the chunks. The file starts
+ * with the settings the chunks were generated with, followed by one record
+ * per chunk holding its coordinates and VoxelStorage. Records are only ever
+ * appended, so an interrupted bake resumes after the last complete record.
+ */
+class BakedWorld {
+ public:
+  struct Settings {
+    int64_t seed = 0;
+    /**
+     * @brief The FbmPreset of the generator.
+     */
+    int32_t generator = 0;
+    uint32_t divisions = 16;
+    double chunk_size = 16;
+    bool density = false;
+
+    bool operator==(const Settings &other) const {
+      return seed == other.seed && generator == other.generator &&
+             divisions == other.divisions && chunk_size == other.chunk_size &&
+             density == other.density;
+    }
+  };
+
+  /**
+   * @brief Loads an existing file into memory and indexes its records.
+   * Returns false if the file is missing or not a baked world.
+   */
+  bool open(const std::string &path);
+
+  /**
+   * @brief Opens the file for appending chunks, creating it if it doesn't
+   * exist. The settings of an existing file must match. A record cut short
+   * by an interrupted bake is dropped.
+   */
+  bool open_for_append(const std::string &path, const Settings &settings);
+
+  const Settings &settings() const;
+
+  /**
+   * @brief The number of chunks in the file.
+   */
+  size_t size() const;
+
+  bool contains(int64_t x, int64_t y, int64_t z) const;
+
+  /**
+   * @brief Reads the voxels of the chunk from a world loaded with open.
+   * Returns false if the chunk isn't in the file. Takes no lock, so several
+   * threads read concurrently.
+   */
+  bool read(int64_t x, int64_t y, int64_t z, VoxelStorage *voxels) const;
+
+  /**
+   * @brief The bytes of the file loaded by open.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * @brief Appends the voxels of the chunk. May be called from several
+   * threads.
+   */
+  bool append(int64_t x, int64_t y, int64_t z, const VoxelStorage &voxels);
+
+ private:
+  struct Coord {
+    int64_t x, y, z;
+
+    bool operator==(const Coord &other) const {
+      return x == other.x && y == other.y && z == other.z;
+    }
+  };
+
+  struct CoordHash {
+    size_t operator()(const Coord &c) const {
+      return size_t(c.x * 73856093) ^ size_t(c.y * 19349663) ^
+             size_t(c.z * 83492791);
+    }
+  };
+
+  bool read_header();
+  void write_header();
+
+  /**
+   * @brief Indexes the records after the header. Returns the end of the last
+   * complete record.
+   */
+  std::streamoff index_records();
+
+  std::fstream _file;
+  mutable std::mutex _mutex;
+  Settings _settings;
+
+  /**
+   * @brief The offset of every chunk's VoxelStorage in the file. Only append
+   * changes it after open_for_append.
+   */
+  std::unordered_map<Coord, std::streamoff, CoordHash> _index;
+
+  /**
+   * @brief The content of a file loaded by open, which never changes
+   * afterwards.
+   */
+  std::vector<char> _data;
+};
+}  // namespace godot
+
+#endif  // BAKEDWORLD_H
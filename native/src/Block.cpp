@@ -0,0 +1,85 @@
+#include "Block.h"
+
+#include <Image.hpp>
+#include <Shader.hpp>
+
+namespace godot {
+
+BlockTexture block_texture(Block block, BlockFace face) {
+  switch (block) {
+    case Block::GRASS:
+      if (face == BlockFace::TOP) {
+        return BlockTexture::GRASS_TOP;
+      } else if (face == BlockFace::SIDE) {
+        return BlockTexture::GRASS_SIDE;
+      }
+      return BlockTexture::DIRT;
+    case Block::DIRT:
+      return BlockTexture::DIRT;
+    case Block::SAND:
+      return BlockTexture::SAND;
+    default:
+      return BlockTexture::STONE;
+  }
+}
+
+Ref<TextureArray> create_default_block_textures() {
+  constexpr int64_t TEXTURE_SIZE = 16;
+  const Color base_colors[size_t(BlockTexture::COUNT)] = {
+      Color(0.30, 0.55, 0.18),  // GRASS_TOP
+      Color(0.45, 0.33, 0.18),  // GRASS_SIDE
+      Color(0.45, 0.33, 0.18),  // DIRT
+      Color(0.45, 0.45, 0.47),  // STONE
+      Color(0.86, 0.80, 0.58),  // SAND
+  };
+
+  Ref<TextureArray> textures(TextureArray::_new());
+  textures->create(TEXTURE_SIZE, TEXTURE_SIZE, size_t(BlockTexture::COUNT),
+                   Image::FORMAT_RGBA8, TextureArray::FLAG_REPEAT);
+
+  // A cheap integer hash gives every texel a stable brightness variation
+  uint32_t state = 0x9E3779B9;
+  for (size_t layer = 0; layer < size_t(BlockTexture::COUNT); ++layer) {
+    Ref<Image> image(Image::_new());
+    image->create(TEXTURE_SIZE, TEXTURE_SIZE, false, Image::FORMAT_RGBA8);
+    image->lock();
+    for (int64_t y = 0; y < TEXTURE_SIZE; ++y) {
+      for (int64_t x = 0; x < TEXTURE_SIZE; ++x) {
+        state ^= state << 13;
+        state ^= state >> 17;
+        state ^= state << 5;
+        float shade = (state % 1000) / 1000.0f * 0.2f - 0.1f;
+        Color c = base_colors[layer];
+        if (layer == size_t(BlockTexture::GRASS_SIDE) && y < 4) {
+          // the upper rim of grass blocks is green
+          c = base_colors[size_t(BlockTexture::GRASS_TOP)];
+        }
+        image->set_pixel(x, y, Color(c.r + shade, c.g + shade, c.b + shade));
+      }
+    }
+    image->unlock();
+    textures->set_layer_data(image, layer);
+  }
+  return textures;
+}
+
+Ref<ShaderMaterial> create_block_material(Ref<TextureArray> textures) {
+  Ref<Shader> shader(Shader::_new());
+  shader->set_code(
+      "shader_type spatial;\n"
+      "uniform sampler2DArray block_textures;\n"
+      "varying float layer;\n"
+      "void vertex() {\n"
+      "  layer = UV2.x;\n"
+      "}\n"
+      "void fragment() {\n"
+      "  ALBEDO = texture(block_textures, vec3(UV, floor(layer + 0.5))).rgb;\n"
+      "  ROUGHNESS = 1.0;\n"
+      "}\n");
+
+  Ref<ShaderMaterial> material(ShaderMaterial::_new());
+  material->set_shader(shader);
+  material->set_shader_param("block_textures", textures);
+  return material;
+}
+}  // namespace godot
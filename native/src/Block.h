@@ -0,0 +1,47 @@
+#ifndef BLOCK_H
+#define BLOCK_H
+
+#include <Godot.hpp>
+#include <ShaderMaterial.hpp>
+#include <TextureArray.hpp>
+
+#include <cstdint>
+
+#include "BlockType.h"
+
+namespace godot {
+
+/**
+ * @brief The layers of the shared block texture array.
+ */
+enum class BlockTexture : uint8_t {
+  GRASS_TOP = 0,
+  GRASS_SIDE,
+  DIRT,
+  STONE,
+  SAND,
+  COUNT
+};
+
+enum class BlockFace : uint8_t { TOP, BOTTOM, SIDE };
+
+/**
+ * @brief Returns the texture array layer used for the given face of a block.
+ */
+BlockTexture block_texture(Block block, BlockFace face);
+
+/**
+ * @brief Generates a simple procedural texture array with one layer per
+ * BlockTexture. Used when no textures are assigned to the terrain.
+ */
+Ref<TextureArray> create_default_block_textures();
+
+/**
+ * @brief Creates the material shared by all chunks. The texture array layer of
+ * every vertex is passed in the x coordinate of its second uv channel, so all
+ * block types are drawn with a single surface per chunk.
+ */
+Ref<ShaderMaterial> create_block_material(Ref<TextureArray> textures);
+}  // namespace godot
+
+#endif  // BLOCK_H
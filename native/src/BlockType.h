@@ -0,0 +1,16 @@
+#ifndef BLOCKTYPE_H
+#define BLOCKTYPE_H
+
+#include <cstdint>
+
+namespace godot {
+
+/**
+ * @brief The types of voxels. Air has to be 0, as freshly reset voxel storage
+ * is filled with 0. Kept apart from Block.h, which uses the engine, so the
+ * offline baker can fill chunks without it.
+ */
+enum class Block : uint8_t { AIR = 0, GRASS, DIRT, STONE, SAND, COUNT };
+}  // namespace godot
+
+#endif  // BLOCKTYPE_H
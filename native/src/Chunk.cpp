@@ -8,76 +8,173 @@
 #include <Shape.hpp>
 #include <VisualServer.hpp>
 #include <World.hpp>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <cstring>
+
+#include "BakedWorld.h"
+#include "MeshCache.h"
+#include "Trace.h"
 
 namespace godot {
 
-Chunk::Chunk() : _world_size(16), _size(16), _state(State::UNUSED) {
-  set_noise(OpenSimplexNoise::_new());
-  _spatial_material = Ref<SpatialMaterial>(SpatialMaterial::_new());
-  _lock = Mutex::_new();
-  _state_lock = Mutex::_new();
+Chunk::Chunk()
+    : _generator(nullptr),
+      _world_size(16),
+      _size(16),
+      _visibility(~uint64_t(0)),
+      _state(State::UNUSED),
+      _generation(0),
+      _mesh_cache(nullptr),
+      _baked_world(nullptr),
+      _mesh_hash(0),
+      _shape_hash(0),
+      _decorations_drawn(false),
+      _batched(false),
+      _density(false),
+      _visible(true),
+      _keep_mesh_data(true) {
+  _mesh_data.data_index = 0;
+  _mesh_data.indices_index = 0;
+  _mesh_data.hash = 0;
 }
 
 Chunk::~Chunk() {
-  _lock->free();
-  _state_lock->free();
   clear_physics_body();
   clear_visual_instance();
+  clear_decorations();
 }
 
-Chunk::State Chunk::get_state() {
-  State s;
-  _state_lock->lock();
-  s = _state;
-  _state_lock->unlock();
-  return s;
+Chunk::State Chunk::get_state() { return _state.load(); }
+
+void Chunk::set_state(State s) { _state.store(s); }
+
+uint64_t Chunk::get_generation() const { return _generation.load(); }
+
+void Chunk::cancel() { _generation++; }
+
+void Chunk::set_generator(TerrainGenerator *generator) {
+  _generator = generator;
 }
 
-void Chunk::set_state(State s) {
-  _state_lock->lock();
-  _state = s;
-  _state_lock->unlock();
+void Chunk::set_material(Ref<Material> material) { _material = material; }
+
+void Chunk::set_mesh_cache(MeshCache *cache) { _mesh_cache = cache; }
+
+void Chunk::set_baked_world(BakedWorld *baked_world) {
+  _baked_world = baked_world;
 }
 
-void Chunk::set_noise(Ref<OpenSimplexNoise> noise) { _noise = noise; }
+bool Chunk::build_terrain() { return build_terrain(get_generation()); }
 
-void Chunk::build_terrain() {
-  using namespace std::chrono;
+bool Chunk::build_terrain(uint64_t generation) {
+  return build_voxels(generation, nullptr) &&
+         build_mesh(generation, unpack_voxels());
+}
 
-  //  time_point start = high_resolution_clock::now();
+template <typename F>
+auto Chunk::with_size(F f) const {
+  // Specialise the common sizes, so the strides are compile time constants
+  // and the loops over the voxels can be unrolled
+  switch (_size) {
+    case 16:
+      return f(FixedSize<16>());
+    case 32:
+      return f(FixedSize<32>());
+    case 64:
+      return f(FixedSize<64>());
+    default:
+      return f(RuntimeSize{_size});
+  }
+}
 
-  constexpr double TERRAIN_SCALE = 20;
-  double voxel_size = _world_size / _size;
-  double half_size = _world_size / 2;
+bool Chunk::build_voxels(uint64_t generation, const double *heights) {
+  return with_size(
+      [&](auto size) { return build_voxels(generation, heights, size); });
+}
+
+const uint8_t *Chunk::unpack_voxels() const {
+  thread_local std::vector<uint8_t> blocks;
+  blocks.resize(_voxels.size());
+  _voxels.unpack(blocks.data());
+  return blocks.data();
+}
 
-  size_t num_voxels = _size * _size * _size;
-  _voxels.resize(_world_size * _world_size * _world_size);
+bool Chunk::build_mesh(uint64_t generation, const uint8_t *blocks) {
+  return with_size(
+      [&](auto size) { return build_mesh(generation, blocks, size); });
+}
 
-  // compute the terrain height
-  std::vector<double> _heights(_world_size * _world_size);
-  for (size_t z = 0; z < _world_size; ++z) {
-    for (size_t x = 0; x < _world_size; ++x) {
-      _heights[x + z * _size] =
-          _noise->get_noise_2d(position.x + x * voxel_size - half_size,
-                               position.z + z * voxel_size - half_size);
+template <typename Size>
+bool Chunk::build_voxels(uint64_t generation, const double *heights,
+                         Size size) {
+  // A compile time constant for the specialised sizes
+  const size_t n = size.get();
+  size_t num_voxels = n * n * n;
+
+  // Unpacked blocks, reused by all chunks built on this thread. The chunk
+  // only keeps the palette compressed copy.
+  thread_local std::vector<uint8_t> blocks;
+  blocks.resize(num_voxels);
+
+  // The chunk coordinates, as the baked world indexes them
+  int64_t cx = int64_t(std::round(position.x / _world_size));
+  int64_t cy = int64_t(std::round(position.y / _world_size));
+  int64_t cz = int64_t(std::round(position.z / _world_size));
+  if (_baked_world != nullptr && _baked_world->read(cx, cy, cz, &_voxels) &&
+      _voxels.size() == num_voxels) {
+    // Baked chunks only need their mesh built
+    VOXEL_TRACE_BEGIN("voxels", cx, cy, cz);
+    _voxels.unpack(blocks.data());
+  } else {
+    VOXEL_TRACE_BEGIN("sample", cx, cy, cz);
+    thread_local VoxelFiller filler;
+    if (heights != nullptr) {
+      filler.sample(_generator, position.x, position.y, position.z,
+                    _world_size, n, _density, heights);
+    } else {
+      filler.sample(_generator, position.x, position.y, position.z,
+                    _world_size, n, _density);
     }
-  }
+    VOXEL_TRACE_END("sample");
 
-  // Initialize the voxels
-  for (size_t y = 0; y < _size; ++y) {
-    double world_y = position.y + y * voxel_size - half_size;
-    for (size_t z = 0; z < _size; ++z) {
-      for (size_t x = 0; x < _size; ++x) {
-        voxel(x, y, z) = world_y < _heights[x + z * _size] * TERRAIN_SCALE;
-      }
+    if (_generation.load() != generation) {
+      return false;
     }
+
+    VOXEL_TRACE_BEGIN("voxels", cx, cy, cz);
+    filler.fill(size, blocks.data());
+    _voxels.assign(blocks.data(), num_voxels);
   }
+  compute_visibility(blocks, size);
+  VoxelFiller::bottom_air(blocks.data(), size, &_bottom_air);
+  VOXEL_TRACE_END("voxels");
+
+  return _generation.load() == generation;
+}
+
+template <typename Size>
+bool Chunk::build_mesh(uint64_t generation, const uint8_t *blocks,
+                       Size size) {
+  using namespace std::chrono;
+
+  //  time_point start = high_resolution_clock::now();
+
+  // A compile time constant for the specialised sizes
+  const size_t n = size.get();
+  double voxel_size = _world_size / n;
+  double half_size = _world_size / 2;
+
+  size_t num_voxels = n * n * n;
 
   // Generate the faces
+  VOXEL_TRACE_BEGIN("mesh", position.x / _world_size, position.y / _world_size,
+                    position.z / _world_size);
   _mesh_data.vertices.resize(num_voxels / 2 * 6 * 4);
   _mesh_data.normals.resize(num_voxels / 2 * 6 * 4);
   _mesh_data.uvs.resize(num_voxels / 2 * 6 * 4);
+  _mesh_data.uv2s.resize(num_voxels / 2 * 6 * 4);
 
   _mesh_data.indices.resize(num_voxels / 2 * 6 * 6);
   _mesh_data.collision_faces.resize(num_voxels / 2 * 6 * 6);
@@ -85,10 +182,11 @@ void Chunk::build_terrain() {
   _mesh_data.data_index = 0;
   _mesh_data.indices_index = 0;
 
-  for (size_t y = 0; y < _size; ++y) {
-    for (size_t z = 0; z < _size; ++z) {
-      for (size_t x = 0; x < _size; ++x) {
-        if (!voxel(x, y, z)) {
+  for (size_t y = 0; y < n; ++y) {
+    for (size_t z = 0; z < n; ++z) {
+      for (size_t x = 0; x < n; ++x) {
+        Block b = Block(blocks[voxel_index(size, x, y, z)]);
+        if (b == Block::AIR) {
           // Air voxels never need geometry
           continue;
         }
@@ -97,24 +195,28 @@ void Chunk::build_terrain() {
         double wy = y * voxel_size - half_size;
         double wz = z * voxel_size - half_size;
 
+        float top = float(block_texture(b, BlockFace::TOP));
+        float bottom = float(block_texture(b, BlockFace::BOTTOM));
+        float side = float(block_texture(b, BlockFace::SIDE));
+
         // Check the face above
-        if (!voxel_or_false(x, y + 1, z)) {
-          create_top_face(wx, wy, wz, voxel_size, &_mesh_data);
+        if (block_or_air(blocks, x, y + 1, z, size) == Block::AIR) {
+          create_top_face(wx, wy, wz, voxel_size, top, &_mesh_data);
         }
-        if (!voxel_or_false(x, y - 1, z)) {
-          create_bottom_face(wx, wy, wz, voxel_size, &_mesh_data);
+        if (block_or_air(blocks, x, y - 1, z, size) == Block::AIR) {
+          create_bottom_face(wx, wy, wz, voxel_size, bottom, &_mesh_data);
         }
-        if (!voxel_or_false(x + 1, y, z)) {
-          create_right_face(wx, wy, wz, voxel_size, &_mesh_data);
+        if (block_or_air(blocks, x + 1, y, z, size) == Block::AIR) {
+          create_right_face(wx, wy, wz, voxel_size, side, &_mesh_data);
         }
-        if (!voxel_or_false(x - 1, y, z)) {
-          create_left_face(wx, wy, wz, voxel_size, &_mesh_data);
+        if (block_or_air(blocks, x - 1, y, z, size) == Block::AIR) {
+          create_left_face(wx, wy, wz, voxel_size, side, &_mesh_data);
         }
-        if (!voxel_or_false(x, y, z + 1)) {
-          create_back_face(wx, wy, wz, voxel_size, &_mesh_data);
+        if (block_or_air(blocks, x, y, z + 1, size) == Block::AIR) {
+          create_back_face(wx, wy, wz, voxel_size, side, &_mesh_data);
         }
-        if (!voxel_or_false(x, y, z - 1)) {
-          create_front_face(wx, wy, wz, voxel_size, &_mesh_data);
+        if (block_or_air(blocks, x, y, z - 1, size) == Block::AIR) {
+          create_front_face(wx, wy, wz, voxel_size, side, &_mesh_data);
         }
       }
     }
@@ -130,13 +232,19 @@ void Chunk::build_terrain() {
     _mesh_data.vertices.resize(_mesh_data.data_index);
     _mesh_data.normals.resize(_mesh_data.data_index);
     _mesh_data.uvs.resize(_mesh_data.data_index);
+    _mesh_data.uv2s.resize(_mesh_data.data_index);
 
     _mesh_data.indices.resize(_mesh_data.indices_index);
     _mesh_data.collision_faces.resize(_mesh_data.indices_index);
 
+    // Hashed here, so the main thread only looks the mesh up
+    if (_mesh_cache != nullptr) {
+      _mesh_data.hash = hash_mesh_data(_mesh_data);
+    }
   } else {
     empty = true;
   }
+  VOXEL_TRACE_END("mesh");
 
   //  time_point end = high_resolution_clock::now();
   //  duration delta = end - start;
@@ -147,6 +255,48 @@ void Chunk::build_terrain() {
   //  Godot::print("Mesh building took " + String::num(msecs, 3) + " ms with " +
   //               String::num(_mesh_data.indices_index) + " indices. " +
   //               String::num(msecs_engine) + " of that was pre mesh upload.");
+
+  return _generation.load() == generation;
+}
+
+bool Chunk::build_navigation(uint64_t generation, const uint8_t *blocks,
+                             int64_t clearance) {
+  VOXEL_TRACE_SCOPE("navigation", position.x / _world_size,
+                    position.y / _world_size, position.z / _world_size);
+  with_size([&](auto size) {
+    NavGraph::extract(blocks, size, clearance, &_nav_chunk);
+  });
+  return _generation.load() == generation;
+}
+
+const NavChunk &Chunk::get_nav_chunk() const { return _nav_chunk; }
+
+bool Chunk::build_decorations(uint64_t generation, const uint8_t *blocks,
+                              int64_t seed, double density) {
+  int64_t cx = int64_t(std::round(position.x / _world_size));
+  int64_t cy = int64_t(std::round(position.y / _world_size));
+  int64_t cz = int64_t(std::round(position.z / _world_size));
+  VOXEL_TRACE_SCOPE("decorations", cx, cy, cz);
+  with_size([&](auto size) {
+    Decorator::scatter(blocks, size, _world_size, cx, cy, cz, seed, density,
+                       &_decorations);
+  });
+  return _generation.load() == generation;
+}
+
+void Chunk::update_decorations(const std::vector<uint8_t> *above_air) {
+  if (_decorations_drawn && _decorations.pending.empty()) {
+    return;
+  }
+  init_decorations(above_air);
+}
+
+const std::vector<uint8_t> &Chunk::get_bottom_air() const {
+  return _bottom_air;
+}
+
+void Chunk::set_decoration_mesh(Decoration decoration, RID mesh) {
+  _decoration_meshes[size_t(decoration)] = mesh;
 }
 
 void Chunk::update_tree() {
@@ -156,7 +306,14 @@ void Chunk::update_tree() {
   if (_mesh_data.indices_index > 0) {
     empty = false;
     init_physics_body();
-    init_visual_instance();
+    if (_batched) {
+      clear_visual_instance();
+    } else {
+      init_visual_instance();
+      if (!_keep_mesh_data) {
+        release_mesh_data();
+      }
+    }
   } else {
     empty = true;
     clear_visual_instance();
@@ -173,11 +330,23 @@ void Chunk::update_tree() {
 
 void Chunk::unload() {
   clear_visual_instance();
+  clear_decorations();
   clear_physics_body();
+  release_data();
+  _visible = true;
+}
+
+void Chunk::release_data() {
+  // Pooled chunks are rebuilt from scratch
+  release_mesh_data();
+  _voxels.reset(0);
+  _bottom_air = std::vector<uint8_t>();
+  _nav_chunk = NavChunk();
+  _decorations = DecorationSet();
 }
 
 void Chunk::create_top_face(double x, double y, double z, double size,
-                            MeshData *data) {
+                            float layer, MeshData *data) {
   // create a new face above the current voxel
   size_t v_idx = data->data_index;
   size_t i_idx = data->indices_index;
@@ -201,6 +370,11 @@ void Chunk::create_top_face(double x, double y, double z, double size,
   data->uvs.set(v_idx + 2, Vector2(0, 1));
   data->uvs.set(v_idx + 3, Vector2(1, 1));
 
+  data->uv2s.set(v_idx + 0, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 1, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 2, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 3, Vector2(layer, 0));
+
   data->indices.set(i_idx + 0, v_idx + 1);
   data->indices.set(i_idx + 1, v_idx + 2);
   data->indices.set(i_idx + 2, v_idx + 0);
@@ -222,7 +396,7 @@ void Chunk::create_top_face(double x, double y, double z, double size,
 }
 
 void Chunk::create_bottom_face(double x, double y, double z, double size,
-                               MeshData *data) {
+                               float layer, MeshData *data) {
   // create a new face above the current voxel
   size_t v_idx = data->data_index;
   size_t i_idx = data->indices_index;
@@ -246,6 +420,11 @@ void Chunk::create_bottom_face(double x, double y, double z, double size,
   data->uvs.set(v_idx + 2, Vector2(0, 1));
   data->uvs.set(v_idx + 3, Vector2(1, 1));
 
+  data->uv2s.set(v_idx + 0, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 1, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 2, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 3, Vector2(layer, 0));
+
   data->indices.set(i_idx + 0, v_idx + 0);
   data->indices.set(i_idx + 1, v_idx + 2);
   data->indices.set(i_idx + 2, v_idx + 1);
@@ -267,7 +446,7 @@ void Chunk::create_bottom_face(double x, double y, double z, double size,
 }
 
 void Chunk::create_left_face(double x, double y, double z, double size,
-                             MeshData *data) {
+                             float layer, MeshData *data) {
   // create a new face above the current voxel
   size_t v_idx = data->data_index;
   size_t i_idx = data->indices_index;
@@ -291,6 +470,11 @@ void Chunk::create_left_face(double x, double y, double z, double size,
   data->uvs.set(v_idx + 2, Vector2(0, 1));
   data->uvs.set(v_idx + 3, Vector2(1, 1));
 
+  data->uv2s.set(v_idx + 0, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 1, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 2, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 3, Vector2(layer, 0));
+
   data->indices.set(i_idx + 0, v_idx + 0);
   data->indices.set(i_idx + 1, v_idx + 2);
   data->indices.set(i_idx + 2, v_idx + 1);
@@ -312,7 +496,7 @@ void Chunk::create_left_face(double x, double y, double z, double size,
 }
 
 void Chunk::create_right_face(double x, double y, double z, double size,
-                              MeshData *data) {
+                              float layer, MeshData *data) {
   // create a new face above the current voxel
   size_t v_idx = data->data_index;
   size_t i_idx = data->indices_index;
@@ -336,6 +520,11 @@ void Chunk::create_right_face(double x, double y, double z, double size,
   data->uvs.set(v_idx + 2, Vector2(0, 1));
   data->uvs.set(v_idx + 3, Vector2(1, 1));
 
+  data->uv2s.set(v_idx + 0, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 1, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 2, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 3, Vector2(layer, 0));
+
   data->indices.set(i_idx + 0, v_idx + 1);
   data->indices.set(i_idx + 1, v_idx + 2);
   data->indices.set(i_idx + 2, v_idx + 0);
@@ -357,7 +546,7 @@ void Chunk::create_right_face(double x, double y, double z, double size,
 }
 
 void Chunk::create_front_face(double x, double y, double z, double size,
-                              MeshData *data) {
+                              float layer, MeshData *data) {
   // create a new face above the current voxel
   size_t v_idx = data->data_index;
   size_t i_idx = data->indices_index;
@@ -381,6 +570,11 @@ void Chunk::create_front_face(double x, double y, double z, double size,
   data->uvs.set(v_idx + 2, Vector2(0, 1));
   data->uvs.set(v_idx + 3, Vector2(1, 1));
 
+  data->uv2s.set(v_idx + 0, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 1, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 2, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 3, Vector2(layer, 0));
+
   data->indices.set(i_idx + 0, v_idx + 1);
   data->indices.set(i_idx + 1, v_idx + 2);
   data->indices.set(i_idx + 2, v_idx + 0);
@@ -402,7 +596,7 @@ void Chunk::create_front_face(double x, double y, double z, double size,
 }
 
 void Chunk::create_back_face(double x, double y, double z, double size,
-                             MeshData *data) {
+                             float layer, MeshData *data) {
   // create a new face above the current voxel
   size_t v_idx = data->data_index;
   size_t i_idx = data->indices_index;
@@ -426,6 +620,11 @@ void Chunk::create_back_face(double x, double y, double z, double size,
   data->uvs.set(v_idx + 2, Vector2(0, 1));
   data->uvs.set(v_idx + 3, Vector2(1, 1));
 
+  data->uv2s.set(v_idx + 0, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 1, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 2, Vector2(layer, 0));
+  data->uv2s.set(v_idx + 3, Vector2(layer, 0));
+
   data->indices.set(i_idx + 0, v_idx + 0);
   data->indices.set(i_idx + 1, v_idx + 2);
   data->indices.set(i_idx + 2, v_idx + 1);
@@ -446,21 +645,132 @@ void Chunk::create_back_face(double x, double y, double z, double size,
   data->indices_index += 6;
 }
 
-std::vector<bool>::reference Chunk::voxel(size_t x, size_t y, size_t z) {
-  return _voxels[x + z * _world_size + y * _world_size * _world_size];
+size_t Chunk::voxel_index(size_t x, size_t y, size_t z) const {
+  return voxel_index(RuntimeSize{_size}, x, y, z);
+}
+
+template <typename Size>
+size_t Chunk::voxel_index(Size size, size_t x, size_t y, size_t z) {
+  return VoxelFiller::voxel_index(size, x, y, z);
+}
+
+template <typename Size>
+Block Chunk::block_or_air(const uint8_t *blocks, int64_t x, int64_t y,
+                          int64_t z, Size size) {
+  int64_t n = size.get();
+  if (x < 0 || y < 0 || z < 0 || x >= n || y >= n || z >= n) {
+    return Block::AIR;
+  }
+  return Block(blocks[voxel_index(size, x, y, z)]);
+}
+
+template <typename Size>
+void Chunk::compute_visibility(const std::vector<uint8_t> &blocks, Size size) {
+  if (_voxels.palette().size() == 1) {
+    // Uniform chunks are either completely open or completely closed
+    _visibility = _voxels.palette()[0] == uint8_t(Block::AIR) ? ~uint64_t(0)
+                                                              : 0;
+    return;
+  }
+
+  thread_local std::vector<bool> visited;
+  thread_local std::vector<size_t> stack;
+  visited.assign(blocks.size(), false);
+
+  auto visit = [&](size_t n) {
+    if (!visited[n] && blocks[n] == uint8_t(Block::AIR)) {
+      visited[n] = true;
+      stack.push_back(n);
+    }
+  };
+
+  _visibility = 0;
+  const size_t n = size.get();
+  size_t last = n - 1;
+  for (size_t start = 0; start < blocks.size(); ++start) {
+    if (visited[start] || blocks[start] != uint8_t(Block::AIR)) {
+      continue;
+    }
+    // Collect the faces touched by the air connected to start
+    uint8_t faces = 0;
+    visited[start] = true;
+    stack.push_back(start);
+    while (!stack.empty()) {
+      size_t i = stack.back();
+      stack.pop_back();
+      size_t x = i % n;
+      size_t z = (i / n) % n;
+      size_t y = i / (n * n);
+
+      if (x == last) {
+        faces |= 1 << POS_X;
+      } else {
+        visit(i + 1);
+      }
+      if (x == 0) {
+        faces |= 1 << NEG_X;
+      } else {
+        visit(i - 1);
+      }
+      if (y == last) {
+        faces |= 1 << POS_Y;
+      } else {
+        visit(i + n * n);
+      }
+      if (y == 0) {
+        faces |= 1 << NEG_Y;
+      } else {
+        visit(i - n * n);
+      }
+      if (z == last) {
+        faces |= 1 << POS_Z;
+      } else {
+        visit(i + n);
+      }
+      if (z == 0) {
+        faces |= 1 << NEG_Z;
+      } else {
+        visit(i - n);
+      }
+    }
+
+    for (size_t a = 0; a < FACE_COUNT; ++a) {
+      for (size_t b = 0; b < FACE_COUNT; ++b) {
+        if ((faces & (1 << a)) && (faces & (1 << b))) {
+          _visibility |= uint64_t(1) << (a * FACE_COUNT + b);
+        }
+      }
+    }
+  }
+}
+
+bool Chunk::faces_connected(Face a, Face b) const {
+  return _visibility & (uint64_t(1) << (a * FACE_COUNT + b));
 }
 
-bool Chunk::voxel_or_false(int64_t x, int64_t y, int64_t z) {
-  if (x < 0 || y < 0 || z < 0 || x >= _world_size || y >= _world_size ||
-      z >= _world_size) {
-    return false;
+void Chunk::set_visible(bool visible) {
+  if (visible == _visible) {
+    return;
   }
-  return voxel(x, y, z);
+  _visible = visible;
+  if (_visual_instance.is_valid()) {
+    VisualServer::get_singleton()->instance_set_visible(_visual_instance,
+                                                        visible);
+  }
+  for (RID &instance : _decoration_instances) {
+    if (instance.is_valid()) {
+      VisualServer::get_singleton()->instance_set_visible(instance, visible);
+    }
+  }
+}
+
+Block Chunk::get_block(size_t x, size_t y, size_t z) const {
+  return Block(_voxels.get(voxel_index(x, y, z)));
 }
 
-void Chunk::lock() { _lock->lock(); }
+void Chunk::lock() { _lock.lock(); }
 
-void Chunk::unlock() { _lock->unlock(); }
+void Chunk::unlock() { _lock.unlock(); }
 
 void Chunk::set_size(size_t size) { _size = size; }
 void Chunk::set_world_size(double world_size) { _world_size = world_size; }
@@ -469,6 +779,100 @@ void Chunk::set_space_rid(RID space_rid) { _space_rid = space_rid; }
 
 void Chunk::set_scenario_rid(RID scenario_rid) { _scenario_rid = scenario_rid; }
 
+void Chunk::set_batched(bool batched) { _batched = batched; }
+
+void Chunk::set_density(bool density) { _density = density; }
+
+const Chunk::MeshData &Chunk::get_mesh_data() const { return _mesh_data; }
+
+void Chunk::set_keep_mesh_data(bool keep) { _keep_mesh_data = keep; }
+
+size_t Chunk::memory_usage() const {
+  return sizeof(Chunk) + _voxels.memory_usage() +
+         _mesh_data.vertices.size() * sizeof(Vector3) +
+         _mesh_data.normals.size() * sizeof(Vector3) +
+         _mesh_data.uvs.size() * sizeof(Vector2) +
+         _mesh_data.uv2s.size() * sizeof(Vector2) +
+         _mesh_data.indices.size() * sizeof(int) +
+         _mesh_data.collision_faces.size() * sizeof(Vector3) +
+         _nav_chunk.cells.size() * sizeof(uint32_t) +
+         _nav_chunk.headroom.size() + _bottom_air.size() +
+         _decorations.memory_usage();
+}
+
+void Chunk::release_mesh_data() {
+  _mesh_data = MeshData();
+  _mesh_data.data_index = 0;
+  _mesh_data.indices_index = 0;
+  _mesh_data.hash = 0;
+}
+
+namespace {
+/**
+ * @brief Mixes the bytes into the hash eight at a time.
+ */
+uint64_t hash_bytes(const void *data, size_t size, uint64_t hash) {
+  constexpr uint64_t MULTIPLIER = 0x9e3779b97f4a7c15ULL;
+  const uint8_t *bytes = static_cast<const uint8_t *>(data);
+  size_t i = 0;
+  for (; i + sizeof(uint64_t) <= size; i += sizeof(uint64_t)) {
+    uint64_t word;
+    std::memcpy(&word, bytes + i, sizeof(uint64_t));
+    hash = (hash ^ word) * MULTIPLIER;
+    hash ^= hash >> 29;
+  }
+  for (; i < size; ++i) {
+    hash = (hash ^ bytes[i]) * MULTIPLIER;
+    hash ^= hash >> 29;
+  }
+  // The length separates arrays that only differ in where they are split
+  return (hash ^ size) * MULTIPLIER;
+}
+}  // namespace
+
+uint64_t Chunk::hash_mesh_data(const MeshData &data) {
+  // The collision faces follow from the vertices and indices
+  uint64_t hash = 0xcbf29ce484222325ULL;
+  hash = hash_bytes(data.vertices.read().ptr(),
+                    data.vertices.size() * sizeof(Vector3), hash);
+  hash = hash_bytes(data.normals.read().ptr(),
+                    data.normals.size() * sizeof(Vector3), hash);
+  hash = hash_bytes(data.uvs.read().ptr(), data.uvs.size() * sizeof(Vector2),
+                    hash);
+  hash = hash_bytes(data.uv2s.read().ptr(),
+                    data.uv2s.size() * sizeof(Vector2), hash);
+  hash = hash_bytes(data.indices.read().ptr(),
+                    data.indices.size() * sizeof(int), hash);
+  return hash;
+}
+
+RID Chunk::create_mesh(const MeshData &data, Ref<Material> material) {
+  VisualServer *visual = VisualServer::get_singleton();
+  Array arrays;
+  arrays.resize(ArrayMesh::ARRAY_MAX);
+  arrays[ArrayMesh::ARRAY_VERTEX] = data.vertices;
+  arrays[ArrayMesh::ARRAY_NORMAL] = data.normals;
+  arrays[ArrayMesh::ARRAY_TEX_UV] = data.uvs;
+  arrays[ArrayMesh::ARRAY_TEX_UV2] = data.uv2s;
+  arrays[ArrayMesh::ARRAY_INDEX] = data.indices;
+
+  RID mesh = visual->mesh_create();
+  visual->mesh_add_surface_from_arrays(mesh, VisualServer::PRIMITIVE_TRIANGLES,
+                                       arrays);
+  if (material.is_valid()) {
+    visual->mesh_surface_set_material(mesh, 0, material->get_rid());
+  }
+  return mesh;
+}
+
+RID Chunk::create_shape(const MeshData &data) {
+  PhysicsServer *physics = PhysicsServer::get_singleton();
+  RID shape =
+      physics->shape_create(PhysicsServer::ShapeType::SHAPE_CONCAVE_POLYGON);
+  physics->shape_set_data(shape, data.collision_faces);
+  return shape;
+}
+
 void Chunk::init_physics_body() {
   PhysicsServer *physics = PhysicsServer::get_singleton();
   clear_physics_body();
@@ -480,9 +884,12 @@ void Chunk::init_physics_body() {
   Transform shape_transform;
   shape_transform.origin = position;
 
-  _shape_rid =
-      physics->shape_create(PhysicsServer::ShapeType::SHAPE_CONCAVE_POLYGON);
-  physics->shape_set_data(_shape_rid, _mesh_data.collision_faces);
+  if (_mesh_cache != nullptr) {
+    _shape_rid = _mesh_cache->acquire_shape(_mesh_data);
+    _shape_hash = _mesh_data.hash;
+  } else {
+    _shape_rid = create_shape(_mesh_data);
+  }
   physics->body_add_shape(_body_rid, _shape_rid, shape_transform);
 }
 
@@ -493,7 +900,11 @@ void Chunk::clear_physics_body() {
     _body_rid = RID();
   }
   if (_shape_rid.is_valid()) {
-    physics->free_rid(_shape_rid);
+    if (_mesh_cache != nullptr) {
+      _mesh_cache->release_shape(_shape_hash, _shape_rid);
+    } else {
+      physics->free_rid(_shape_rid);
+    }
     _shape_rid = RID();
   }
 }
@@ -502,17 +913,12 @@ void Chunk::init_visual_instance() {
   VisualServer *visual = VisualServer::get_singleton();
   clear_visual_instance();
 
-  Array arrays;
-  arrays.resize(ArrayMesh::ARRAY_MAX);
-  arrays[ArrayMesh::ARRAY_VERTEX] = _mesh_data.vertices;
-  arrays[ArrayMesh::ARRAY_NORMAL] = _mesh_data.normals;
-  arrays[ArrayMesh::ARRAY_TEX_UV] = _mesh_data.uvs;
-  arrays[ArrayMesh::ARRAY_INDEX] = _mesh_data.indices;
-
-  _mesh_rid = visual->mesh_create();
-  visual->mesh_add_surface_from_arrays(
-      _mesh_rid, VisualServer::PRIMITIVE_TRIANGLES, arrays);
-  visual->mesh_surface_set_material(_mesh_rid, 0, _spatial_material->get_rid());
+  if (_mesh_cache != nullptr) {
+    _mesh_rid = _mesh_cache->acquire_mesh(_mesh_data);
+    _mesh_hash = _mesh_data.hash;
+  } else {
+    _mesh_rid = create_mesh(_mesh_data, _material);
+  }
 
   _visual_instance = visual->instance_create();
   visual->instance_set_scenario(_visual_instance, _scenario_rid);
@@ -521,12 +927,19 @@ void Chunk::init_visual_instance() {
   Transform visual_transform;
   visual_transform.origin = position;
   visual->instance_set_transform(_visual_instance, visual_transform);
+  if (!_visible) {
+    visual->instance_set_visible(_visual_instance, false);
+  }
 }
 
 void Chunk::clear_visual_instance() {
   VisualServer *visual = VisualServer::get_singleton();
   if (_mesh_rid.is_valid()) {
-    visual->free_rid(_mesh_rid);
+    if (_mesh_cache != nullptr) {
+      _mesh_cache->release_mesh(_mesh_hash, _mesh_rid);
+    } else {
+      visual->free_rid(_mesh_rid);
+    }
     _mesh_rid = RID();
   }
   if (_visual_instance.is_valid()) {
@@ -534,4 +947,69 @@ void Chunk::clear_visual_instance() {
     _visual_instance = RID();
   }
 }
+
+void Chunk::init_decorations(const std::vector<uint8_t> *above_air) {
+  VisualServer *visual = VisualServer::get_singleton();
+  clear_decorations();
+  _decorations_drawn = true;
+
+  Transform transform;
+  transform.origin = position;
+  std::vector<float> transforms;
+  for (size_t i = 0; i < DECORATION_COUNT; ++i) {
+    if (!_decoration_meshes[i].is_valid()) {
+      continue;
+    }
+    transforms = _decorations.transforms[i];
+    if (above_air != nullptr) {
+      for (const DecorationSet::Pending &p : _decorations.pending) {
+        if (size_t(p.decoration) == i && (*above_air)[p.column] >= p.air) {
+          transforms.insert(
+              transforms.end(), p.transform,
+              p.transform + DecorationSet::FLOATS_PER_INSTANCE);
+        }
+      }
+    }
+    int64_t count = transforms.size() / DecorationSet::FLOATS_PER_INSTANCE;
+    if (count == 0) {
+      continue;
+    }
+    PoolRealArray bulk;
+    bulk.resize(transforms.size());
+    {
+      PoolRealArray::Write w = bulk.write();
+      std::copy(transforms.begin(), transforms.end(), w.ptr());
+    }
+
+    _multimeshes[i] = visual->multimesh_create();
+    visual->multimesh_allocate(_multimeshes[i], count,
+                               VisualServer::MULTIMESH_TRANSFORM_3D,
+                               VisualServer::MULTIMESH_COLOR_NONE);
+    visual->multimesh_set_mesh(_multimeshes[i], _decoration_meshes[i]);
+    visual->multimesh_set_as_bulk_array(_multimeshes[i], bulk);
+
+    _decoration_instances[i] = visual->instance_create();
+    visual->instance_set_scenario(_decoration_instances[i], _scenario_rid);
+    visual->instance_set_base(_decoration_instances[i], _multimeshes[i]);
+    visual->instance_set_transform(_decoration_instances[i], transform);
+    if (!_visible) {
+      visual->instance_set_visible(_decoration_instances[i], false);
+    }
+  }
+}
+
+void Chunk::clear_decorations() {
+  VisualServer *visual = VisualServer::get_singleton();
+  _decorations_drawn = false;
+  for (size_t i = 0; i < DECORATION_COUNT; ++i) {
+    if (_decoration_instances[i].is_valid()) {
+      visual->free_rid(_decoration_instances[i]);
+      _decoration_instances[i] = RID();
+    }
+    if (_multimeshes[i].is_valid()) {
+      visual->free_rid(_multimeshes[i]);
+      _multimeshes[i] = RID();
+    }
+  }
+}
 }  // namespace godot
@@ -5,55 +5,238 @@
 #include <Godot.hpp>
 #include <Material.hpp>
 #include <MeshInstance.hpp>
-#include <Mutex.hpp>
-#include <OpenSimplexNoise.hpp>
 #include <StaticBody.hpp>
+#include <atomic>
+#include <chrono>
+#include <mutex>
 #include <vector>
 
-#include <SpatialMaterial.hpp>
+#include "Block.h"
+#include "Decorator.h"
+#include "NavGraph.h"
+#include "TerrainGenerator.h"
+#include "VoxelFiller.h"
+#include "VoxelStorage.h"
 
 namespace godot {
-class Chunk {
+class BakedWorld;
+class MeshCache;
 
+class Chunk {
+ public:
   struct MeshData {
     PoolVector3Array vertices;
     PoolVector3Array normals;
     PoolVector2Array uvs;
+    /**
+     * @brief The x coordinate holds the texture array layer of the vertex.
+     */
+    PoolVector2Array uv2s;
     PoolIntArray indices;
 
     PoolVector3Array collision_faces;
 
     size_t data_index;
     size_t indices_index;
+
+    /**
+     * @brief A hash of the finished mesh arrays, computed by the worker
+     * when the chunk has a MeshCache. Chunks with equal hashes share their
+     * mesh and shape through it.
+     */
+    uint64_t hash;
   };
 
- public:
   enum class State { UNUSED, BUILDING, ACTIVE };
 
+  /**
+   * @brief The faces of a chunk, in the order used by the visibility matrix.
+   */
+  enum Face { POS_X = 0, NEG_X, POS_Y, NEG_Y, POS_Z, NEG_Z, FACE_COUNT };
+
   Chunk();
   virtual ~Chunk();
 
-  void set_noise(Ref<OpenSimplexNoise> noise);
+  /**
+   * @brief Sets the generator providing the terrain heights. The generator is
+   * shared by all chunks and owned by the terrain.
+   */
+  void set_generator(TerrainGenerator *generator);
+
+  /**
+   * @brief Sets the material used to render the chunk. All chunks of a terrain
+   * share a single material.
+   */
+  void set_material(Ref<Material> material);
+
+  /**
+   * @brief Sets the cache the mesh and collision shape are shared through,
+   * or nullptr to give the chunk its own. Must only be changed while the
+   * chunk has no visual instance or physics body.
+   */
+  void set_mesh_cache(MeshCache *cache);
+
+  /**
+   * @brief Sets the pregenerated voxels to load the chunk from, or nullptr.
+   * Chunks missing from the baked world are generated as usual.
+   */
+  void set_baked_world(BakedWorld *baked_world);
+
+  /**
+   * @brief Builds the voxels and mesh of the chunk. Returns false without
+   * finishing the build if the chunk was cancelled after generation was
+   * taken.
+   */
+  bool build_terrain(uint64_t generation);
+  bool build_terrain();
+
+  /**
+   * @brief The first stage of build_terrain, fills the voxels. Heights may
+   * hold the heights of the chunk's column as sampled by
+   * VoxelFiller::sample_heights, which are shared by the chunks above each
+   * other. If it is nullptr the chunk samples its own.
+   */
+  bool build_voxels(uint64_t generation, const double *heights);
+
+  /**
+   * @brief Unpacks the voxels into a buffer of the calling thread, valid
+   * until the next unpack on the thread. The stages after build_voxels all
+   * take their blocks from one unpack.
+   */
+  const uint8_t *unpack_voxels() const;
+
+  /**
+   * @brief The second stage of build_terrain, builds the mesh and collision
+   * faces from the blocks returned by unpack_voxels.
+   */
+  bool build_mesh(uint64_t generation, const uint8_t *blocks);
+
+  /**
+   * @brief Extracts the walkable voxels for the NavGraph, runs on the worker
+   * after build_mesh with the same blocks.
+   */
+  bool build_navigation(uint64_t generation, const uint8_t *blocks,
+                        int64_t clearance);
+  const NavChunk &get_nav_chunk() const;
+
+  /**
+   * @brief Scatters the decorations with the Decorator, runs on the worker
+   * after build_mesh with the same blocks.
+   */
+  bool build_decorations(uint64_t generation, const uint8_t *blocks,
+                         int64_t seed, double density);
 
-  void build_terrain();
+  /**
+   * @brief Draws the decorations, including the pending ones that above_air
+   * has enough air for. above_air holds the bottom air of the chunk above, as
+   * get_bottom_air returns it, or is nullptr while that chunk isn't active.
+   * Does nothing if the decorations are drawn and none are pending.
+   */
+  void update_decorations(const std::vector<uint8_t> *above_air);
+
+  /**
+   * @brief The air voxels at the bottom of each column, computed by
+   * build_voxels with VoxelFiller::bottom_air.
+   */
+  const std::vector<uint8_t> &get_bottom_air() const;
+
+  /**
+   * @brief The mesh drawn for every placement of the decoration. Decorations
+   * without a mesh are not drawn.
+   */
+  void set_decoration_mesh(Decoration decoration, RID mesh);
   void update_tree();
   void unload();
 
+  /**
+   * @brief Releases the cpu side voxels, mesh, navigation and decoration data
+   * without touching the servers, so a worker may call it on a chunk that
+   * never reached the scene. unload calls it as well.
+   */
+  void release_data();
+
   void lock();
   void unlock();
 
   Vector3 position;
   bool empty;
 
+  /**
+   * @brief When the chunk was requested, used to measure how long it takes
+   * to load chunks.
+   */
+  std::chrono::steady_clock::time_point request_time;
+
   void set_size(size_t size);
   void set_world_size(double world_size);
 
   State get_state();
   void set_state(State s);
 
+  /**
+   * @brief Returns the current generation of the chunk. A build started with
+   * an older generation is stale.
+   */
+  uint64_t get_generation() const;
+
+  /**
+   * @brief Makes all builds started so far stale. Builds check for this
+   * between stages and stop early.
+   */
+  void cancel();
+
   void set_space_rid(RID space_rid);
   void set_scenario_rid(RID scenario_rid);
 
+  /**
+   * @brief Batched chunks are rendered by their region and don't create their
+   * own visual instance.
+   */
+  void set_batched(bool batched);
+
+  /**
+   * @brief If true the voxels are filled from the heightfield plus the 3d
+   * density of the generator, which allows overhangs and caves. The density is
+   * sampled every DENSITY_STEP voxels and interpolated in between.
+   */
+  void set_density(bool density);
+
+  /**
+   * @brief The cpu side mesh of the chunk, as built by build_terrain.
+   */
+  const MeshData &get_mesh_data() const;
+
+  /**
+   * @brief If false the cpu side mesh data is released once the physics and
+   * visual servers own copies of it. Batched chunks always keep it, their
+   * region needs it for rebuilds.
+   */
+  void set_keep_mesh_data(bool keep);
+
+  /**
+   * @brief The number of bytes currently used by the chunk, including its
+   * voxels and cpu side mesh data.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * @brief Returns true if the air inside the chunk connects the two faces,
+   * i.e. if something behind face b may be seen when looking into the chunk
+   * through face a.
+   */
+  bool faces_connected(Face a, Face b) const;
+
+  /**
+   * @brief Shows or hides the chunks visual instance. The flag is kept when
+   * the instance is recreated.
+   */
+  void set_visible(bool visible);
+
+  /**
+   * @brief Returns the block at the given voxel coordinates. Only valid once
+   * the terrain was built.
+   */
+  Block get_block(size_t x, size_t y, size_t z) const;
 
   /**
    * @brief Uses the physics server to create a static body and shape for the
@@ -69,35 +252,79 @@ class Chunk {
 
   void clear_visual_instance();
 
+  /**
+   * @brief Draws the decorations with one multimesh instance per decoration,
+   * which follows the chunk's visual instance through unload and
+   * set_visible.
+   */
+  void init_decorations(const std::vector<uint8_t> *above_air);
+  void clear_decorations();
+
+  /**
+   * @brief Creates a mesh or concave collision shape from the mesh data. The
+   * caller owns the returned RID.
+   */
+  static RID create_mesh(const MeshData &data, Ref<Material> material);
+  static RID create_shape(const MeshData &data);
+
  private:
-  std::vector<bool>::reference voxel(size_t x, size_t y, size_t z);
+  /**
+   * @brief Calls f with the size of the chunk, specialised for the common
+   * sizes.
+   */
+  template <typename F>
+  auto with_size(F f) const;
+
+  template <typename Size>
+  bool build_voxels(uint64_t generation, const double *heights, Size size);
+
+  template <typename Size>
+  bool build_mesh(uint64_t generation, const uint8_t *blocks, Size size);
+
+  size_t voxel_index(size_t x, size_t y, size_t z) const;
+
+  template <typename Size>
+  static size_t voxel_index(Size size, size_t x, size_t y, size_t z);
+
+  void release_mesh_data();
+
+  static uint64_t hash_mesh_data(const MeshData &data);
+
+  /**
+   * @brief Flood fills the air in the chunk to compute which faces of the
+   * chunk are connected by air.
+   */
+  template <typename Size>
+  void compute_visibility(const std::vector<uint8_t> &blocks, Size size);
 
   static void create_top_face(double x, double y, double z, double size,
-                              MeshData *data);
+                              float layer, MeshData *data);
 
   static void create_bottom_face(double x, double y, double z, double size,
-                                 MeshData *data);
+                                 float layer, MeshData *data);
 
   static void create_left_face(double x, double y, double z, double size,
-                               MeshData *data);
+                               float layer, MeshData *data);
 
   static void create_right_face(double x, double y, double z, double size,
-                                MeshData *data);
+                                float layer, MeshData *data);
 
   static void create_front_face(double x, double y, double z, double size,
-                                MeshData *data);
+                                float layer, MeshData *data);
 
   static void create_back_face(double x, double y, double z, double size,
-                               MeshData *data);
+                               float layer, MeshData *data);
 
   /**
-   * @brief Returns the voxel in this chunk or false if the coordinates are
-   * outside the chunk
+   * @brief Returns the block in the unpacked blocks or air if the coordinates
+   * are outside the chunk
    */
-  bool voxel_or_false(int64_t x, int64_t y, int64_t z);
+  template <typename Size>
+  static Block block_or_air(const uint8_t *blocks, int64_t x, int64_t y,
+                            int64_t z, Size size);
 
 
-  Ref<OpenSimplexNoise> _noise;
+  TerrainGenerator *_generator;
 
   /**
    * @brief The extend of the chunk in world space. Chunks are cubes.
@@ -109,15 +336,37 @@ class Chunk {
    */
   size_t _size;
 
-  std::vector<bool> _voxels;
+  VoxelStorage _voxels;
+
+  /**
+   * @brief A 6x6 bit matrix, bit a * FACE_COUNT + b is set if faces a and b
+   * are connected.
+   */
+  uint64_t _visibility;
+  /**
+   * @brief The air at the bottom of each column, which the decorations and
+   * the navigation of the chunk below are confirmed with.
+   */
+  std::vector<uint8_t> _bottom_air;
 
   MeshData _mesh_data;
+  NavChunk _nav_chunk;
 
-  Mutex *_lock;
-  Mutex *_state_lock;
-  State _state;
+  std::mutex _lock;
+  std::atomic<State> _state;
 
-  Ref<SpatialMaterial> _spatial_material;
+  std::atomic<uint64_t> _generation;
+
+  Ref<Material> _material;
+
+  MeshCache *_mesh_cache;
+  BakedWorld *_baked_world;
+  /**
+   * @brief The hashes the mesh and shape were acquired from the cache with,
+   * the mesh data may have been rebuilt or released since.
+   */
+  uint64_t _mesh_hash;
+  uint64_t _shape_hash;
 
   RID _shape_rid;
   RID _body_rid;
@@ -125,7 +374,18 @@ class Chunk {
   RID _visual_instance;
   RID _mesh_rid;
 
+  DecorationSet _decorations;
+  RID _decoration_meshes[DECORATION_COUNT];
+  RID _multimeshes[DECORATION_COUNT];
+  RID _decoration_instances[DECORATION_COUNT];
+  bool _decorations_drawn;
+
   RID _space_rid;
   RID _scenario_rid;
+
+  bool _batched;
+  bool _density;
+  bool _visible;
+  bool _keep_mesh_data;
 };
 }  // namespace godot
@@ -0,0 +1,194 @@
+#include "Decorator.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+
+#include "BlockType.h"
+
+namespace godot {
+
+namespace {
+/**
+ * @brief The chance of a decoration on a candidate face, before the density
+ * and the clustering noise scale it.
+ */
+constexpr double GRASS_CHANCE = 0.35;
+constexpr double ROCK_CHANCE = 0.03;
+constexpr double TREE_CHANCE = 0.02;
+
+/**
+ * @brief The air voxels a tree needs above its face.
+ */
+constexpr size_t TREE_HEADROOM = 4;
+
+/**
+ * @brief The extent of a cell of the clustering noise in voxels.
+ */
+constexpr double CLUSTER_SIZE = 12;
+
+constexpr double TAU = 6.283185307179586;
+
+uint64_t mix(uint64_t hash) {
+  hash ^= hash >> 30;
+  hash *= 0xbf58476d1ce4e5b9ULL;
+  hash ^= hash >> 27;
+  hash *= 0x94d049bb133111ebULL;
+  return hash ^ (hash >> 31);
+}
+
+uint64_t hash_voxel(int64_t x, int64_t y, int64_t z, int64_t seed) {
+  uint64_t hash = mix(uint64_t(seed));
+  hash = mix(hash ^ uint64_t(x));
+  hash = mix(hash ^ uint64_t(y));
+  return mix(hash ^ uint64_t(z));
+}
+
+/**
+ * @brief A uniform value in [0, 1) taken from the given 16 bits of the hash.
+ */
+double unit(uint64_t hash, int part) {
+  return double((hash >> (part * 16)) & 0xffff) / 65536.0;
+}
+
+/**
+ * @brief Smoothly interpolated value noise in [0, 1].
+ */
+double cluster_noise(double x, double z, int64_t seed) {
+  double fx = std::floor(x);
+  double fz = std::floor(z);
+  int64_t ix = int64_t(fx);
+  int64_t iz = int64_t(fz);
+  double tx = x - fx;
+  double tz = z - fz;
+  tx = tx * tx * (3 - 2 * tx);
+  tz = tz * tz * (3 - 2 * tz);
+  auto corner = [&](int64_t dx, int64_t dz) {
+    return unit(hash_voxel(ix + dx, 0, iz + dz, ~seed), 0);
+  };
+  double a = corner(0, 0) + (corner(1, 0) - corner(0, 0)) * tx;
+  double b = corner(0, 1) + (corner(1, 1) - corner(0, 1)) * tx;
+  return a + (b - a) * tz;
+}
+
+void add_instance(double x, double y, double z, double angle, double scale,
+                  std::vector<float> *transforms) {
+  // A rotation about the y axis, scaled uniformly
+  float c = float(std::cos(angle) * scale);
+  float s = float(std::sin(angle) * scale);
+  float values[DecorationSet::FLOATS_PER_INSTANCE] = {
+      c, 0, s, float(x), 0, float(scale), 0, float(y), -s, 0, c, float(z)};
+  transforms->insert(transforms->end(), values,
+                     values + DecorationSet::FLOATS_PER_INSTANCE);
+}
+}  // namespace
+
+void DecorationSet::clear() {
+  for (std::vector<float> &t : transforms) {
+    t.clear();
+  }
+  pending.clear();
+}
+
+size_t DecorationSet::memory_usage() const {
+  size_t bytes = pending.size() * sizeof(Pending);
+  for (const std::vector<float> &t : transforms) {
+    bytes += t.size() * sizeof(float);
+  }
+  return bytes;
+}
+
+template <typename Size>
+void Decorator::scatter(const uint8_t *blocks, Size size, double world_size,
+                        int64_t cx, int64_t cy, int64_t cz, int64_t seed,
+                        double density, DecorationSet *decorations) {
+  // A compile time constant for the specialised sizes
+  const size_t n = size.get();
+  decorations->clear();
+  double voxel_size = world_size / n;
+  double half_size = world_size / 2;
+  for (size_t z = 0; z < n; ++z) {
+    for (size_t x = 0; x < n; ++x) {
+      int64_t gx = cx * int64_t(n) + int64_t(x);
+      int64_t gz = cz * int64_t(n) + int64_t(z);
+      double cluster =
+          cluster_noise(gx / CLUSTER_SIZE, gz / CLUSTER_SIZE, seed);
+
+      // Walk down the column, counting the air above each solid voxel. The
+      // topmost solid voxel may have more air in the chunk above.
+      size_t above = 0;
+      bool open = true;
+      for (size_t y = n; y-- > 0;) {
+        Block block = Block(blocks[x + z * n + y * n * n]);
+        if (block == Block::AIR) {
+          above++;
+          continue;
+        }
+        size_t headroom = above;
+        // The most air the face may have
+        size_t reach = open ? SIZE_MAX : headroom;
+        above = 0;
+        open = false;
+        if (reach == 0) {
+          continue;
+        }
+
+        int64_t gy = cy * int64_t(n) + int64_t(y);
+        uint64_t hash = hash_voxel(gx, gy, gz, seed);
+        double roll = unit(hash, 0);
+        Decoration decoration = Decoration::COUNT;
+        double scale = 1;
+        if (block == Block::GRASS) {
+          if (reach >= TREE_HEADROOM &&
+              roll < TREE_CHANCE * density * cluster * 2) {
+            decoration = Decoration::TREE;
+            scale = 0.8 + 0.4 * unit(hash, 3);
+          } else if (roll < GRASS_CHANCE * density * (0.5 + cluster)) {
+            decoration = Decoration::GRASS;
+            scale = 0.6 + 0.6 * unit(hash, 3);
+          }
+        } else if (roll < ROCK_CHANCE * density) {
+          decoration = Decoration::ROCK;
+          scale = 0.4 + 0.6 * unit(hash, 3);
+        }
+        if (decoration == Decoration::COUNT) {
+          continue;
+        }
+
+        // Jitter within the face, so the instances don't line up in a grid
+        double px = (x + 0.1 + 0.8 * unit(hash, 1)) * voxel_size - half_size;
+        double pz = (z + 0.1 + 0.8 * unit(hash, 2)) * voxel_size - half_size;
+        double py = (y + 1) * voxel_size - half_size;
+        double angle = unit(mix(hash), 0) * TAU;
+        size_t required = decoration == Decoration::TREE ? TREE_HEADROOM : 1;
+        if (headroom >= required) {
+          add_instance(px, py, pz, angle, scale * voxel_size,
+                       &decorations->transforms[size_t(decoration)]);
+          continue;
+        }
+        std::vector<float> transform;
+        add_instance(px, py, pz, angle, scale * voxel_size, &transform);
+        DecorationSet::Pending pending;
+        pending.decoration = decoration;
+        pending.column = uint32_t(x + z * n);
+        pending.air = uint32_t(required - headroom);
+        std::copy(transform.begin(), transform.end(), pending.transform);
+        decorations->pending.push_back(pending);
+      }
+    }
+  }
+}
+
+template void Decorator::scatter(const uint8_t *, FixedSize<16>, double,
+                                 int64_t, int64_t, int64_t, int64_t, double,
+                                 DecorationSet *);
+template void Decorator::scatter(const uint8_t *, FixedSize<32>, double,
+                                 int64_t, int64_t, int64_t, int64_t, double,
+                                 DecorationSet *);
+template void Decorator::scatter(const uint8_t *, FixedSize<64>, double,
+                                 int64_t, int64_t, int64_t, int64_t, double,
+                                 DecorationSet *);
+template void Decorator::scatter(const uint8_t *, RuntimeSize, double,
+                                 int64_t, int64_t, int64_t, int64_t, double,
+                                 DecorationSet *);
+}  // namespace godot
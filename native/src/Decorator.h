@@ -0,0 +1,83 @@
+#ifndef DECORATOR_H
+#define DECORATOR_H
+
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "VoxelFiller.h"
+
+namespace godot {
+
+/**
+ * @brief The kinds of objects scattered on the terrain. Each kind is drawn
+ * with one multimesh per chunk.
+ */
+enum class Decoration : uint8_t { GRASS = 0, ROCK, TREE, COUNT };
+
+constexpr size_t DECORATION_COUNT = size_t(Decoration::COUNT);
+
+/**
+ * @brief The placements of one chunk, relative to the chunk's center.
+ */
+struct DecorationSet {
+  /**
+   * @brief The floats of one instance, the three rows of the basis each
+   * followed by one coordinate of the origin. This is the layout
+   * VisualServer::multimesh_set_as_bulk_array takes.
+   */
+  static constexpr size_t FLOATS_PER_INSTANCE = 12;
+
+  /**
+   * @brief A placement whose headroom reaches into the chunk above. It is
+   * only drawn once the chunk above has air at the bottom of the column.
+   */
+  struct Pending {
+    Decoration decoration;
+    /**
+     * @brief The column x + z * n and the air voxels needed at its bottom in
+     * the chunk above.
+     */
+    uint32_t column;
+    uint32_t air;
+    float transform[FLOATS_PER_INSTANCE];
+  };
+
+  /**
+   * @brief The placements that have all their headroom inside the chunk.
+   */
+  std::vector<float> transforms[DECORATION_COUNT];
+  std::vector<Pending> pending;
+
+  size_t count(Decoration decoration) const {
+    return transforms[size_t(decoration)].size() / FLOATS_PER_INSTANCE;
+  }
+  void clear();
+  size_t memory_usage() const;
+};
+
+/**
+ * @brief Chooses where decorations stand on a chunk. Every exposed top face
+ * of a voxel is a candidate, a hash of its position in the world decides
+ * whether and what stands on it, and a low frequency value noise groups the
+ * plants into meadows and groves. The placements only depend on the seed and
+ * the voxels, so a chunk decorates the same way every time it is loaded.
+ * Faces whose air continues into the chunk above are left pending until that
+ * chunk confirms the air, so buried chunks don't decorate their top layer.
+ */
+class Decorator {
+ public:
+  /**
+   * @brief Scatters the decorations of a chunk of size^3 blocks indexed by
+   * VoxelFiller::voxel_index, with the given extent and chunk coordinates.
+   * Density scales the chance of every decoration. Instantiated for the sizes
+   * Chunk specialises.
+   */
+  template <typename Size>
+  static void scatter(const uint8_t *blocks, Size size, double world_size,
+                      int64_t cx, int64_t cy, int64_t cz, int64_t seed,
+                      double density, DecorationSet *decorations);
+};
+}  // namespace godot
+
+#endif  // DECORATOR_H
@@ -0,0 +1,24 @@
+#include "FbmGenerator.h"
+
+namespace godot {
+
+// Instantiate the presets here, so their inner loops are only compiled once
+template class PipelineGenerator<fbm::Hills>;
+template class PipelineGenerator<fbm::Mountains>;
+template class PipelineGenerator<fbm::WarpedCanyons>;
+
+std::unique_ptr<TerrainGenerator> create_fbm_generator(FbmPreset preset,
+                                                       uint32_t seed) {
+  switch (preset) {
+    case FbmPreset::MOUNTAINS:
+      return std::unique_ptr<TerrainGenerator>(
+          new PipelineGenerator<fbm::Mountains>(seed));
+    case FbmPreset::WARPED_CANYONS:
+      return std::unique_ptr<TerrainGenerator>(
+          new PipelineGenerator<fbm::WarpedCanyons>(seed));
+    default:
+      return std::unique_ptr<TerrainGenerator>(
+          new PipelineGenerator<fbm::Hills>(seed));
+  }
+}
+}  // namespace godot
@@ -0,0 +1,249 @@
+#ifndef FBMGENERATOR_H
+#define FBMGENERATOR_H
+
+#include <cmath>
+#include <cstdint>
+#include <memory>
+
+#include "Noise.h"
+#include "TerrainGenerator.h"
+
+namespace godot {
+
+/**
+ * @brief Building blocks for terrain generators that are composed at compile
+ * time. Every layer is a type with a static sample function, so a whole
+ * pipeline inlines into the loop of PipelineGenerator::generate_heights, the
+ * octave loops have constant trip counts and can be fully unrolled.
+ */
+namespace fbm {
+
+/**
+ * @brief Fractal sum of Octaves layers of noise, each with twice the frequency
+ * and half the amplitude of the previous one. Returns roughly [-1, 1].
+ */
+template <uint32_t Octaves, uint32_t Layer = 0>
+struct Fbm {
+  static inline double sample(const Noise &noise, double x, double z) {
+    double sum = 0;
+    double amplitude = 1;
+    double frequency = 1;
+    double norm = 0;
+    for (uint32_t o = 0; o < Octaves; ++o) {
+      sum += noise.sample(x * frequency, z * frequency, Layer * 16 + o) *
+             amplitude;
+      norm += amplitude;
+      amplitude *= 0.5;
+      frequency *= 2;
+    }
+    return sum / norm;
+  }
+};
+
+/**
+ * @brief The 3d version of Fbm, for density layers.
+ */
+template <uint32_t Octaves, uint32_t Layer = 6>
+struct Fbm3 {
+  static inline double sample(const Noise &noise, double x, double y,
+                              double z) {
+    double sum = 0;
+    double amplitude = 1;
+    double frequency = 1;
+    double norm = 0;
+    for (uint32_t o = 0; o < Octaves; ++o) {
+      sum += noise.sample(x * frequency, y * frequency, z * frequency,
+                          Layer * 16 + o) *
+             amplitude;
+      norm += amplitude;
+      amplitude *= 0.5;
+      frequency *= 2;
+    }
+    return sum / norm;
+  }
+};
+
+/**
+ * @brief Ridged multifractal noise, sharp crests where the noise crosses
+ * zero. Each octave is weighted by the previous one, so ridges get detail and
+ * valleys stay smooth. Returns roughly [0, 1].
+ */
+template <uint32_t Octaves, uint32_t Layer = 1>
+struct Ridged {
+  static inline double sample(const Noise &noise, double x, double z) {
+    double sum = 0;
+    double amplitude = 1;
+    double frequency = 1;
+    double weight = 1;
+    double norm = 0;
+    for (uint32_t o = 0; o < Octaves; ++o) {
+      double n = 1 - std::abs(noise.sample(x * frequency, z * frequency,
+                                           Layer * 16 + o));
+      n = n * n * weight;
+      weight = n < 0 ? 0 : (n > 1 ? 1 : n);
+      sum += n * amplitude;
+      norm += amplitude;
+      amplitude *= 0.5;
+      frequency *= 2;
+    }
+    return sum / norm;
+  }
+};
+
+/**
+ * @brief Samples Inner at coordinates displaced by two samples of Warp,
+ * scaled by Strength world units.
+ */
+template <typename Warp, typename Inner, int32_t Strength>
+struct DomainWarp {
+  static inline double sample(const Noise &noise, double x, double z) {
+    // Offset the second sample, so the displacement along x and z differs
+    double wx = Warp::sample(noise, x, z);
+    double wz = Warp::sample(noise, x + 31.7, z - 47.3);
+    return Inner::sample(noise, x + wx * Strength, z + wz * Strength);
+  }
+};
+
+/**
+ * @brief Samples Inner with the coordinates scaled by Num / Den, i.e. with a
+ * period of Den / Num world units for base noise.
+ */
+template <typename Inner, int32_t Num, int32_t Den>
+struct Frequency {
+  static inline double sample(const Noise &noise, double x, double z) {
+    constexpr double f = double(Num) / Den;
+    return Inner::sample(noise, x * f, z * f);
+  }
+};
+
+/**
+ * @brief Multiplies Inner by Num / Den.
+ */
+template <typename Inner, int32_t Num, int32_t Den = 1>
+struct Scale {
+  static inline double sample(const Noise &noise, double x, double z) {
+    constexpr double s = double(Num) / Den;
+    return Inner::sample(noise, x, z) * s;
+  }
+};
+
+template <typename A, typename B>
+struct Add {
+  static inline double sample(const Noise &noise, double x, double z) {
+    return A::sample(noise, x, z) + B::sample(noise, x, z);
+  }
+};
+
+template <typename A, typename B>
+struct Mul {
+  static inline double sample(const Noise &noise, double x, double z) {
+    return A::sample(noise, x, z) * B::sample(noise, x, z);
+  }
+};
+
+template <typename A, typename B>
+struct Max {
+  static inline double sample(const Noise &noise, double x, double z) {
+    double a = A::sample(noise, x, z);
+    double b = B::sample(noise, x, z);
+    return a > b ? a : b;
+  }
+};
+
+/**
+ * @brief Blends from A to B as Mask goes from -1 to 1.
+ */
+template <typename A, typename B, typename Mask>
+struct Blend {
+  static inline double sample(const Noise &noise, double x, double z) {
+    double t = Mask::sample(noise, x, z) * 0.5 + 0.5;
+    t = t < 0 ? 0 : (t > 1 ? 1 : t);
+    return A::sample(noise, x, z) * (1 - t) + B::sample(noise, x, z) * t;
+  }
+};
+
+/**
+ * @brief Rolling hills.
+ */
+using Hills = Scale<Frequency<Fbm<5>, 1, 160>, 24>;
+
+/**
+ * @brief Ridged mountain ranges over low hills, with plains in between.
+ */
+using Mountains =
+    Add<Scale<Frequency<Fbm<4>, 1, 200>, 12>,
+        Scale<Blend<Scale<Frequency<Fbm<3, 2>, 1, 90>, 1, 4>,
+                    Frequency<Ridged<6>, 1, 260>, Frequency<Fbm<2, 3>, 1, 600>>,
+              56>>;
+
+/**
+ * @brief Hills warped into twisting canyons.
+ */
+using WarpedCanyons =
+    Scale<Frequency<DomainWarp<Fbm<3, 4>, Ridged<8, 5>, 2>, 1, 220>, 40>;
+
+/**
+ * @brief Density for overhangs and caves, up to 18 units of material added or
+ * carved out with features about 40 units across.
+ */
+struct Overhangs {
+  static inline double sample(const Noise &noise, double x, double y,
+                              double z) {
+    constexpr double f = 1.0 / 40;
+    return Fbm3<3>::sample(noise, x * f, y * f, z * f) * 18;
+  }
+};
+}  // namespace fbm
+
+/**
+ * @brief A TerrainGenerator evaluating a compile time pipeline of fbm layers
+ * for the heights and a 3d one for the density.
+ */
+template <typename Pipeline, typename Density = fbm::Overhangs>
+class PipelineGenerator : public TerrainGenerator {
+ public:
+  explicit PipelineGenerator(uint32_t seed) : _noise(seed) {}
+
+  void generate_heights(double x, double z, double step, size_t count_x,
+                        size_t count_z, double *heights) override {
+    const Noise noise = _noise;
+    for (size_t j = 0; j < count_z; ++j) {
+      double wz = z + j * step;
+      double *row = heights + j * count_x;
+      for (size_t i = 0; i < count_x; ++i) {
+        row[i] = Pipeline::sample(noise, x + i * step, wz);
+      }
+    }
+  }
+
+  void generate_density(double x, double y, double z, double step,
+                        size_t count_x, size_t count_y, size_t count_z,
+                        double *density) override {
+    const Noise noise = _noise;
+    for (size_t k = 0; k < count_z; ++k) {
+      double wz = z + k * step;
+      for (size_t j = 0; j < count_y; ++j) {
+        double wy = y + j * step;
+        double *row = density + (j + k * count_y) * count_x;
+        for (size_t i = 0; i < count_x; ++i) {
+          row[i] = Density::sample(noise, x + i * step, wy, wz);
+        }
+      }
+    }
+  }
+
+ private:
+  Noise _noise;
+};
+
+enum class FbmPreset { HILLS, MOUNTAINS, WARPED_CANYONS, COUNT };
+
+/**
+ * @brief Creates a generator for one of the pipelines instantiated in
+ * FbmGenerator.cpp.
+ */
+std::unique_ptr<TerrainGenerator> create_fbm_generator(FbmPreset preset,
+                                                       uint32_t seed);
+}  // namespace godot
+
+#endif  // FBMGENERATOR_H
@@ -6,40 +6,44 @@
 
 namespace godot {
 HeightMap::HeightMap(size_t width, size_t height, double cell_size,
-                     double depth)
+                     double depth, int64_t seed)
     : _width(width + 2),
       _height(height + 2),
       _cell_size(cell_size),
       _depth(depth) {
-  genIsland();
+  genIsland(seed);
   computeDerivative();
 }
 
-double HeightMap::height(size_t x, size_t y) {
+double HeightMap::height(size_t x, size_t y) const {
   // The grid of heights has a border of size 1 to allow for computing
   // well defined derivatives for border points
   return _heights[x + 1 + (y + 1) * _width];
 }
 
-Vector2 HeightMap::derivative(size_t x, size_t y) {
+Vector2 HeightMap::derivative(size_t x, size_t y) const {
   return _derivatives[x + y * (_width - 2)];
 }
 
-void HeightMap::genIsland() {
+void HeightMap::genIsland(int64_t seed) {
   Godot::print(("Generating an island map of size " + std::to_string(_width) +
                 " " + std::to_string(_height))
                    .c_str());
   Ref<OpenSimplexNoise> noise = OpenSimplexNoise::_new();
+  noise->set_seed(seed);
 
-  double half_size_h = _width * _cell_size * 0.5;
-  double half_size_w = _height * _cell_size * 0.5;
+  // The island is centered on the middle of the grid without its border, the
+  // falloff reaches 0 at the middle of its edges
+  double center_x = (_width - 1) * 0.5;
+  double center_y = (_height - 1) * 0.5;
+  double radius = (_width - 3) * _cell_size * 0.5;
   _heights.resize(_width * _height);
   for (size_t y = 0; y < _height; ++y) {
-    double y_world = y * _cell_size - half_size_h;
+    double y_world = (y - center_y) * _cell_size;
     for (size_t x = 0; x < _width; ++x) {
-      double x_world = x * _cell_size - half_size_w;
+      double x_world = (x - center_x) * _cell_size;
       float falloff =
-          1 - min(Vector2(x_world, y_world).length() / half_size_h, 1.0);
+          1 - min(Vector2(x_world, y_world).length() / radius, 1.0);
       // mix two levels of noise
       float height =
           falloff * (_depth / 2 + noise->get_noise_2d(x, y) * _depth +
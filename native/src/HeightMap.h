@@ -4,15 +4,22 @@
 #include <Godot.hpp>
 
 namespace godot {
+/**
+ * @brief A grid of width x height island heights. The island is centered on
+ * the middle point of the grid and falls off towards the middle of its edges.
+ * The noise is sampled at the grid coordinates, independently of the cell
+ * size.
+ */
 class HeightMap {
  public:
-  HeightMap(size_t width, size_t height, double cell_size, double depth);
+  HeightMap(size_t width, size_t height, double cell_size, double depth,
+            int64_t seed = 0);
 
-  double height(size_t x, size_t y);
-  Vector2 derivative(size_t x, size_t y);
+  double height(size_t x, size_t y) const;
+  Vector2 derivative(size_t x, size_t y) const;
 
  private:
-  void genIsland();
+  void genIsland(int64_t seed);
   void computeDerivative();
 
   size_t _width;
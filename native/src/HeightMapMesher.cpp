@@ -0,0 +1,170 @@
+#include "HeightMapMesher.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cstring>
+#include <thread>
+
+namespace godot {
+
+void HeightMapMesher::_register_methods() {
+  register_method("generate", &HeightMapMesher::generate);
+  register_method("build_mesh", &HeightMapMesher::build_mesh);
+  register_method("build_shape", &HeightMapMesher::build_shape);
+}
+
+HeightMapMesher::HeightMapMesher() : _cells(0), _cell_size(1) {}
+
+HeightMapMesher::~HeightMapMesher() {}
+
+void HeightMapMesher::_init() {}
+
+void HeightMapMesher::generate(int64_t cells, double cell_size, double height,
+                               int64_t seed) {
+  _cells = std::max<int64_t>(1, cells);
+  _cell_size = cell_size;
+
+  // One more point than cells along each axis
+  size_t points = _cells + 1;
+  HeightMap map(points, points, cell_size, height, seed);
+  _heights.resize(points * points);
+  _derivatives.resize(points * points);
+  for (size_t z = 0; z < points; ++z) {
+    for (size_t x = 0; x < points; ++x) {
+      _heights[x + z * points] = map.height(x, z);
+      _derivatives[x + z * points] = map.derivative(x, z);
+    }
+  }
+}
+
+Ref<ArrayMesh> HeightMapMesher::build_mesh(double uv_scale, int64_t tiles,
+                                           Ref<Material> material) {
+  Ref<ArrayMesh> mesh(ArrayMesh::_new());
+  if (_heights.empty()) {
+    return mesh;
+  }
+
+  size_t tiles_per_axis =
+      std::max<int64_t>(1, std::min<int64_t>(tiles, _cells));
+  std::vector<Tile> parts(tiles_per_axis * tiles_per_axis);
+  for (size_t tz = 0; tz < tiles_per_axis; ++tz) {
+    for (size_t tx = 0; tx < tiles_per_axis; ++tx) {
+      Tile &tile = parts[tx + tz * tiles_per_axis];
+      // Neighbouring tiles share their border vertices
+      tile.x0 = _cells * tx / tiles_per_axis;
+      tile.x1 = _cells * (tx + 1) / tiles_per_axis;
+      tile.z0 = _cells * tz / tiles_per_axis;
+      tile.z1 = _cells * (tz + 1) / tiles_per_axis;
+    }
+  }
+
+  // The tiles only read the heights, so they are built without locking
+  std::atomic<size_t> next_tile{0};
+  auto build_tiles = [&]() {
+    for (size_t i = next_tile++; i < parts.size(); i = next_tile++) {
+      build_tile(uv_scale, &parts[i]);
+    }
+  };
+  size_t num_threads = std::min<size_t>(
+      parts.size(), std::max(1u, std::thread::hardware_concurrency()));
+  std::vector<std::thread> threads;
+  for (size_t i = 1; i < num_threads; ++i) {
+    threads.emplace_back(build_tiles);
+  }
+  build_tiles();
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+
+  // Only the calling thread touches the engine
+  for (Tile &tile : parts) {
+    PoolVector3Array vertices;
+    vertices.resize(tile.vertices.size());
+    std::memcpy(vertices.write().ptr(), tile.vertices.data(),
+                tile.vertices.size() * sizeof(Vector3));
+    PoolVector3Array normals;
+    normals.resize(tile.normals.size());
+    std::memcpy(normals.write().ptr(), tile.normals.data(),
+                tile.normals.size() * sizeof(Vector3));
+    PoolVector2Array uvs;
+    uvs.resize(tile.uvs.size());
+    std::memcpy(uvs.write().ptr(), tile.uvs.data(),
+                tile.uvs.size() * sizeof(Vector2));
+    PoolIntArray indices;
+    indices.resize(tile.indices.size());
+    std::memcpy(indices.write().ptr(), tile.indices.data(),
+                tile.indices.size() * sizeof(int));
+
+    Array arrays;
+    arrays.resize(ArrayMesh::ARRAY_MAX);
+    arrays[ArrayMesh::ARRAY_VERTEX] = vertices;
+    arrays[ArrayMesh::ARRAY_NORMAL] = normals;
+    arrays[ArrayMesh::ARRAY_TEX_UV] = uvs;
+    arrays[ArrayMesh::ARRAY_INDEX] = indices;
+    mesh->add_surface_from_arrays(Mesh::PRIMITIVE_TRIANGLES, arrays);
+    if (material.is_valid()) {
+      mesh->surface_set_material(mesh->get_surface_count() - 1, material);
+    }
+  }
+  return mesh;
+}
+
+Ref<HeightMapShape> HeightMapMesher::build_shape() {
+  Ref<HeightMapShape> shape(HeightMapShape::_new());
+  if (_heights.empty()) {
+    return shape;
+  }
+  size_t points = _cells + 1;
+  PoolRealArray data;
+  data.resize(_heights.size());
+  {
+    PoolRealArray::Write write = data.write();
+    for (size_t i = 0; i < _heights.size(); ++i) {
+      write[i] = _heights[i];
+    }
+  }
+  shape->set_map_width(points);
+  shape->set_map_depth(points);
+  shape->set_map_data(data);
+  return shape;
+}
+
+Vector3 HeightMapMesher::vertex(size_t x, size_t z) const {
+  double half_size = _cells * _cell_size * 0.5;
+  return Vector3(x * _cell_size - half_size, _heights[x + z * (_cells + 1)],
+                 z * _cell_size - half_size);
+}
+
+void HeightMapMesher::build_tile(double uv_scale, Tile *tile) const {
+  size_t points = _cells + 1;
+  size_t width = tile->x1 - tile->x0 + 1;
+  size_t depth = tile->z1 - tile->z0 + 1;
+
+  tile->vertices.reserve(width * depth);
+  tile->normals.reserve(width * depth);
+  tile->uvs.reserve(width * depth);
+  for (size_t z = tile->z0; z <= tile->z1; ++z) {
+    for (size_t x = tile->x0; x <= tile->x1; ++x) {
+      size_t i = x + z * points;
+      tile->vertices.push_back(vertex(x, z));
+      // The surface y = h(x, z) has the normal (-dh/dx, 1, -dh/dz)
+      const Vector2 &d = _derivatives[i];
+      tile->normals.push_back(Vector3(-d.x, 1, -d.y).normalized());
+      tile->uvs.push_back(Vector2(double(x) / _cells * uv_scale,
+                                  double(z) / _cells * uv_scale));
+    }
+  }
+
+  tile->indices.reserve((width - 1) * (depth - 1) * 6);
+  for (size_t z = 0; z + 1 < depth; ++z) {
+    for (size_t x = 0; x + 1 < width; ++x) {
+      int a = int(x + z * width);
+      int b = a + 1;
+      int c = a + int(width);
+      int d = c + 1;
+      // Clockwise seen from above, which Godot treats as the front
+      tile->indices.insert(tile->indices.end(), {d, a, b, a, d, c});
+    }
+  }
+}
+}  // namespace godot
@@ -0,0 +1,87 @@
+#ifndef HEIGHTMAP_MESHER_H
+#define HEIGHTMAP_MESHER_H
+
+#include <ArrayMesh.hpp>
+#include <Godot.hpp>
+#include <HeightMapShape.hpp>
+#include <Material.hpp>
+#include <Reference.hpp>
+#include <vector>
+
+#include "HeightMap.h"
+
+namespace godot {
+
+/**
+ * @brief Builds an island HeightMap and turns it into an indexed mesh with
+ * shared vertices and a matching HeightMapShape. Normals come from the
+ * derivatives of the heightmap. The mesh is split into tiles that are built in
+ * parallel, each tile becomes a surface of the mesh.
+ */
+class HeightMapMesher : public Reference {
+  GODOT_CLASS(HeightMapMesher, Reference)
+
+ public:
+  static void _register_methods();
+
+  HeightMapMesher();
+  ~HeightMapMesher();
+
+  void _init();
+
+  /**
+   * @brief Generates the heights of cells x cells quads, centered on the
+   * origin.
+   * @param height The height scale of the island.
+   */
+  void generate(int64_t cells, double cell_size, double height, int64_t seed);
+
+  /**
+   * @brief Builds the mesh of the last generated heightmap. The texture
+   * coordinates run from 0 to uv_scale across the island.
+   * @param tiles The number of tiles along each axis.
+   */
+  Ref<ArrayMesh> build_mesh(double uv_scale, int64_t tiles,
+                            Ref<Material> material);
+
+  /**
+   * @brief Builds a collision shape of the last generated heightmap. The
+   * shape has a spacing of 1, scale it by the cell size horizontally.
+   */
+  Ref<HeightMapShape> build_shape();
+
+  /**
+   * @brief The mesh vertex of the grid point, the middle point lies on the
+   * origin.
+   */
+  Vector3 vertex(size_t x, size_t z) const;
+
+ private:
+  struct Tile {
+    /**
+     * @brief The first and last vertex along each axis.
+     */
+    size_t x0, z0, x1, z1;
+
+    std::vector<Vector3> vertices;
+    std::vector<Vector3> normals;
+    std::vector<Vector2> uvs;
+    std::vector<int> indices;
+  };
+
+  void build_tile(double uv_scale, Tile *tile) const;
+
+  size_t _cells;
+  double _cell_size;
+
+  /**
+   * @brief Copies of the heights and derivatives of the HeightMap, so the
+   * tiles don't read the pool arrays concurrently. Indexed by x + z * (_cells
+   * + 1).
+   */
+  std::vector<float> _heights;
+  std::vector<Vector2> _derivatives;
+};
+}  // namespace godot
+
+#endif  // HEIGHTMAP_MESHER_H
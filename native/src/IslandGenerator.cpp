@@ -0,0 +1,52 @@
+#include "IslandGenerator.h"
+
+#include <cmath>
+
+namespace godot {
+
+IslandGenerator::IslandGenerator(size_t cells, double cell_size, double depth,
+                                 int64_t seed)
+    : _cells(cells), _cell_size(cell_size), _sea_level(depth / 2) {
+  // One more point than cells, so the middle of the map lies at cells / 2,
+  // which generate_heights places on the origin
+  HeightMap map(cells + 1, cells + 1, cell_size, depth, seed);
+  _heights.resize(cells * cells);
+  for (size_t z = 0; z < cells; ++z) {
+    for (size_t x = 0; x < cells; ++x) {
+      _heights[x + z * cells] = map.height(x, z) - _sea_level;
+    }
+  }
+}
+
+double IslandGenerator::grid_height(int64_t x, int64_t z) const {
+  if (x < 0 || z < 0 || x >= int64_t(_cells) || z >= int64_t(_cells)) {
+    return -_sea_level;
+  }
+  return _heights[x + z * _cells];
+}
+
+void IslandGenerator::generate_heights(double x, double z, double step,
+                                       size_t count_x, size_t count_z,
+                                       double *heights) {
+  // The grid is centered on the origin
+  double offset = _cells * 0.5;
+  for (size_t j = 0; j < count_z; ++j) {
+    double gz = (z + j * step) / _cell_size + offset;
+    double fz = std::floor(gz);
+    int64_t iz = fz;
+    double tz = gz - fz;
+    for (size_t i = 0; i < count_x; ++i) {
+      double gx = (x + i * step) / _cell_size + offset;
+      double fx = std::floor(gx);
+      int64_t ix = fx;
+      double tx = gx - fx;
+
+      // Bilinear interpolation between the four surrounding cells
+      double h0 = grid_height(ix, iz) * (1 - tx) + grid_height(ix + 1, iz) * tx;
+      double h1 =
+          grid_height(ix, iz + 1) * (1 - tx) + grid_height(ix + 1, iz + 1) * tx;
+      heights[i + j * count_x] = h0 * (1 - tz) + h1 * tz;
+    }
+  }
+}
+}  // namespace godot
@@ -0,0 +1,46 @@
+#ifndef ISLANDGENERATOR_H
+#define ISLANDGENERATOR_H
+
+#include <vector>
+
+#include "HeightMap.h"
+#include "TerrainGenerator.h"
+
+namespace godot {
+
+/**
+ * @brief A single island centered on the origin, generated by a HeightMap.
+ * The island is surrounded by a flat sea floor.
+ */
+class IslandGenerator : public TerrainGenerator {
+ public:
+  /**
+   * @param cells The number of heightmap cells along each axis.
+   * @param cell_size The extent of a cell in world space.
+   * @param depth The height scale of the island.
+   */
+  IslandGenerator(size_t cells, double cell_size, double depth, int64_t seed);
+
+  void generate_heights(double x, double z, double step, size_t count_x,
+                        size_t count_z, double *heights) override;
+
+ private:
+  /**
+   * @brief Returns the height at the grid coordinates, or the sea floor
+   * outside of the grid.
+   */
+  double grid_height(int64_t x, int64_t z) const;
+
+  size_t _cells;
+  double _cell_size;
+  double _sea_level;
+
+  /**
+   * @brief A copy of the heightmap, so sampling doesn't go through the pool
+   * arrays of the HeightMap.
+   */
+  std::vector<double> _heights;
+};
+}  // namespace godot
+
+#endif  // ISLANDGENERATOR_H
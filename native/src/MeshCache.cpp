@@ -0,0 +1,120 @@
+#include "MeshCache.h"
+
+#include <PhysicsServer.hpp>
+#include <VisualServer.hpp>
+
+#include <cstring>
+
+namespace godot {
+
+namespace {
+template <typename A>
+bool same_array(const A &a, const A &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  return a.size() == 0 ||
+         std::memcmp(a.read().ptr(), b.read().ptr(),
+                     a.size() * sizeof(*a.read().ptr())) == 0;
+}
+}  // namespace
+
+MeshCache::MeshCache() : _hits(0) {}
+
+MeshCache::~MeshCache() {
+  for (std::pair<const uint64_t, Entry> &p : _meshes) {
+    VisualServer::get_singleton()->free_rid(p.second.rid);
+  }
+  for (std::pair<const uint64_t, Entry> &p : _shapes) {
+    PhysicsServer::get_singleton()->free_rid(p.second.rid);
+  }
+}
+
+void MeshCache::set_material(Ref<Material> material) { _material = material; }
+
+RID MeshCache::acquire_mesh(const Chunk::MeshData &data) {
+  auto it = _meshes.find(data.hash);
+  if (it != _meshes.end()) {
+    if (!matches(it->second, data)) {
+      // A hash collision, the chunk can't share the mesh
+      return Chunk::create_mesh(data, _material);
+    }
+    _hits++;
+    it->second.references++;
+    return it->second.rid;
+  }
+  RID mesh = Chunk::create_mesh(data, _material);
+  _meshes[data.hash] = create_entry(mesh, data);
+  return mesh;
+}
+
+void MeshCache::release_mesh(uint64_t hash, RID mesh) {
+  auto it = _meshes.find(hash);
+  if (it == _meshes.end() || it->second.rid != mesh) {
+    VisualServer::get_singleton()->free_rid(mesh);
+    return;
+  }
+  if (--it->second.references > 0) {
+    return;
+  }
+  VisualServer::get_singleton()->free_rid(it->second.rid);
+  _meshes.erase(it);
+}
+
+RID MeshCache::acquire_shape(const Chunk::MeshData &data) {
+  auto it = _shapes.find(data.hash);
+  if (it != _shapes.end()) {
+    if (!matches(it->second, data)) {
+      return Chunk::create_shape(data);
+    }
+    _hits++;
+    it->second.references++;
+    return it->second.rid;
+  }
+  RID shape = Chunk::create_shape(data);
+  _shapes[data.hash] = create_entry(shape, data);
+  return shape;
+}
+
+void MeshCache::release_shape(uint64_t hash, RID shape) {
+  auto it = _shapes.find(hash);
+  if (it == _shapes.end() || it->second.rid != shape) {
+    PhysicsServer::get_singleton()->free_rid(shape);
+    return;
+  }
+  if (--it->second.references > 0) {
+    return;
+  }
+  PhysicsServer::get_singleton()->free_rid(it->second.rid);
+  _shapes.erase(it);
+}
+
+size_t MeshCache::mesh_count() const { return _meshes.size(); }
+
+size_t MeshCache::shape_count() const { return _shapes.size(); }
+
+int64_t MeshCache::hits() const { return _hits; }
+
+size_t MeshCache::memory_usage() const {
+  size_t bytes = 0;
+  for (const auto *entries : {&_meshes, &_shapes}) {
+    for (const std::pair<const uint64_t, Entry> &p : *entries) {
+      bytes += p.second.vertices.size() * sizeof(Vector3) +
+               p.second.uv2s.size() * sizeof(Vector2) +
+               p.second.indices.size() * sizeof(int);
+    }
+  }
+  return bytes;
+}
+
+MeshCache::Entry MeshCache::create_entry(RID rid,
+                                         const Chunk::MeshData &data) {
+  return Entry{rid, 1, data.vertices, data.uv2s, data.indices};
+}
+
+bool MeshCache::matches(const Entry &entry, const Chunk::MeshData &data) {
+  return same_array(entry.vertices, data.vertices) &&
+         same_array(entry.uv2s, data.uv2s) &&
+         same_array(entry.indices, data.indices);
+}
+}  // namespace godot
@@ -0,0 +1,95 @@
+#ifndef MESH_CACHE_H
+#define MESH_CACHE_H
+
+#include <Godot.hpp>
+#include <Material.hpp>
+
+#include <cstdint>
+#include <unordered_map>
+
+#include "Chunk.h"
+
+namespace godot {
+
+/**
+ * @brief Shares the mesh and collision shape RIDs of chunks with identical
+ * mesh data. Plains and ocean floors produce the same mesh over and over,
+ * with a cache those chunks only create their own instance and body. Entries
+ * are keyed by MeshData::hash and freed once the last chunk released them.
+ * An entry keeps the arrays it was created from, so a hash collision is
+ * caught by comparing them and the colliding chunk gets its own RID. Only
+ * used from the main thread.
+ */
+class MeshCache {
+ public:
+  MeshCache();
+  ~MeshCache();
+
+  /**
+   * @brief The material of the shared meshes. Must be set before the first
+   * mesh is acquired.
+   */
+  void set_material(Ref<Material> material);
+
+  /**
+   * @brief Returns the mesh for the data, creating it if no chunk with the
+   * same data holds one. Every acquire needs a release with data.hash and
+   * the returned RID.
+   */
+  RID acquire_mesh(const Chunk::MeshData &data);
+  void release_mesh(uint64_t hash, RID mesh);
+
+  /**
+   * @brief Returns the concave collision shape for the data, creating it if
+   * no chunk with the same data holds one.
+   */
+  RID acquire_shape(const Chunk::MeshData &data);
+  void release_shape(uint64_t hash, RID shape);
+
+  /**
+   * @brief The number of distinct meshes and shapes currently alive.
+   */
+  size_t mesh_count() const;
+  size_t shape_count() const;
+
+  /**
+   * @brief The number of acquires that reused an existing mesh or shape.
+   */
+  int64_t hits() const;
+
+  /**
+   * @brief The bytes of the arrays kept by the entries. Arrays shared with a
+   * chunk or another entry are counted again.
+   */
+  size_t memory_usage() const;
+
+ private:
+  struct Entry {
+    RID rid;
+    int64_t references;
+    /**
+     * @brief The arrays the RID was created from. The other arrays follow
+     * from them. They share their memory with the chunk's arrays until those
+     * are released.
+     */
+    PoolVector3Array vertices;
+    PoolVector2Array uv2s;
+    PoolIntArray indices;
+  };
+
+  static Entry create_entry(RID rid, const Chunk::MeshData &data);
+  /**
+   * @brief Whether the entry was created from the same arrays as the data.
+   */
+  static bool matches(const Entry &entry, const Chunk::MeshData &data);
+
+  std::unordered_map<uint64_t, Entry> _meshes;
+  std::unordered_map<uint64_t, Entry> _shapes;
+
+  Ref<Material> _material;
+
+  int64_t _hits;
+};
+}  // namespace godot
+
+#endif  // MESH_CACHE_H
@@ -0,0 +1,291 @@
+#include "NavGraph.h"
+
+#include <algorithm>
+#include <cmath>
+#include <queue>
+#include <unordered_set>
+
+namespace godot {
+
+namespace {
+/**
+ * @brief The headroom of nodes with nothing but air or unloaded chunks above.
+ */
+constexpr int64_t OPEN_HEADROOM = int64_t(1) << 20;
+
+constexpr int64_t DIRECTIONS[4][2] = {{1, 0}, {-1, 0}, {0, 1}, {0, -1}};
+
+struct OpenEntry {
+  double f;
+  NavCoord coord;
+
+  bool operator>(const OpenEntry &other) const { return f > other.f; }
+};
+
+struct Visit {
+  double g;
+  NavCoord parent;
+  bool closed;
+};
+}  // namespace
+
+void NavGraph::configure(size_t chunk_voxels, int64_t clearance,
+                         int64_t max_step, int64_t max_drop) {
+  _n = int64_t(chunk_voxels);
+  _clearance = std::max<int64_t>(1, clearance);
+  _max_step = std::max<int64_t>(0, max_step);
+  _max_drop = std::max<int64_t>(0, max_drop);
+  _chunks.clear();
+  _nodes.clear();
+}
+
+template <typename Size>
+void NavGraph::extract(const uint8_t *blocks, Size size, int64_t clearance,
+                       NavChunk *nav) {
+  // A compile time constant for the specialised sizes
+  const size_t n = size.get();
+  nav->cells.clear();
+  nav->headroom.clear();
+  for (size_t z = 0; z < n; ++z) {
+    for (size_t x = 0; x < n; ++x) {
+      // Walk down the column, counting the air above each solid voxel
+      size_t above = 0;
+      for (size_t y = n; y-- > 0;) {
+        size_t index = x + z * n + y * n * n;
+        if (blocks[index] == 0) {
+          above++;
+          continue;
+        }
+        bool open = y + 1 + above == n;
+        if (open || int64_t(above) >= clearance) {
+          nav->cells.push_back(uint32_t(index));
+          nav->headroom.push_back(uint8_t(std::min<size_t>(above, 255)));
+        }
+        above = 0;
+      }
+    }
+  }
+}
+
+template void NavGraph::extract(const uint8_t *, FixedSize<16>, int64_t,
+                                NavChunk *);
+template void NavGraph::extract(const uint8_t *, FixedSize<32>, int64_t,
+                                NavChunk *);
+template void NavGraph::extract(const uint8_t *, FixedSize<64>, int64_t,
+                                NavChunk *);
+template void NavGraph::extract(const uint8_t *, RuntimeSize, int64_t,
+                                NavChunk *);
+
+void NavGraph::add_chunk(int64_t x, int64_t y, int64_t z, NavChunk nav) {
+  NavCoord cc{x, y, z};
+  std::vector<NavCoord> changed;
+  erase_nodes(cc, &changed);
+  _chunks[cc] = std::move(nav);
+  update_nodes(cc, false, &changed);
+  // The chunk limits the headroom of the chunk below
+  update_nodes(NavCoord{x, y - 1, z}, true, &changed);
+  relink(changed);
+}
+
+void NavGraph::remove_chunk(int64_t x, int64_t y, int64_t z) {
+  NavCoord cc{x, y, z};
+  auto it = _chunks.find(cc);
+  if (it == _chunks.end()) {
+    return;
+  }
+  std::vector<NavCoord> changed;
+  erase_nodes(cc, &changed);
+  _chunks.erase(it);
+  update_nodes(NavCoord{x, y - 1, z}, true, &changed);
+  relink(changed);
+}
+
+size_t NavGraph::chunk_count() const { return _chunks.size(); }
+
+size_t NavGraph::node_count() const { return _nodes.size(); }
+
+bool NavGraph::contains(const NavCoord &node) const {
+  return _nodes.count(node) > 0;
+}
+
+const std::vector<NavCoord> &NavGraph::links(const NavCoord &node) const {
+  static const std::vector<NavCoord> none;
+  auto it = _nodes.find(node);
+  return it != _nodes.end() ? it->second.links : none;
+}
+
+bool NavGraph::find_node(int64_t x, int64_t y, int64_t z, int64_t depth,
+                         NavCoord *node) const {
+  for (int64_t ny = y; ny >= y - depth; --ny) {
+    NavCoord c{x, ny, z};
+    if (contains(c)) {
+      *node = c;
+      return true;
+    }
+  }
+  return false;
+}
+
+bool NavGraph::find_path(const NavCoord &from, const NavCoord &to,
+                         std::vector<NavCoord> *path,
+                         size_t max_visited) const {
+  path->clear();
+  if (!contains(from) || !contains(to)) {
+    return false;
+  }
+  auto distance = [](const NavCoord &a, const NavCoord &b) {
+    double dx = double(a.x - b.x);
+    double dy = double(a.y - b.y);
+    double dz = double(a.z - b.z);
+    return std::sqrt(dx * dx + dy * dy + dz * dz);
+  };
+
+  std::priority_queue<OpenEntry, std::vector<OpenEntry>,
+                      std::greater<OpenEntry>>
+      open;
+  std::unordered_map<NavCoord, Visit, NavCoordHash> visits;
+  visits[from] = Visit{0, from, false};
+  open.push(OpenEntry{distance(from, to), from});
+  size_t visited = 0;
+  while (!open.empty()) {
+    NavCoord current = open.top().coord;
+    open.pop();
+    Visit &visit = visits[current];
+    if (visit.closed) {
+      continue;
+    }
+    visit.closed = true;
+    double g = visit.g;
+
+    if (current == to) {
+      for (NavCoord c = to; !(c == from); c = visits[c].parent) {
+        path->push_back(c);
+      }
+      path->push_back(from);
+      std::reverse(path->begin(), path->end());
+      return true;
+    }
+    if (max_visited > 0 && ++visited > max_visited) {
+      return false;
+    }
+
+    for (const NavCoord &next : _nodes.at(current).links) {
+      // Links are never shorter than the straight line, so the heuristic
+      // stays admissible
+      double cost = g + distance(current, next);
+      auto it = visits.find(next);
+      if (it != visits.end() && (it->second.closed || it->second.g <= cost)) {
+        continue;
+      }
+      visits[next] = Visit{cost, current, false};
+      open.push(OpenEntry{cost + distance(next, to), next});
+    }
+  }
+  return false;
+}
+
+void NavGraph::erase_nodes(const NavCoord &cc,
+                           std::vector<NavCoord> *changed) {
+  auto it = _chunks.find(cc);
+  if (it == _chunks.end()) {
+    return;
+  }
+  for (uint32_t cell : it->second.cells) {
+    NavCoord c = cell_coord(cc, cell);
+    if (_nodes.erase(c) > 0) {
+      changed->push_back(c);
+    }
+  }
+}
+
+void NavGraph::update_nodes(const NavCoord &cc, bool top_only,
+                            std::vector<NavCoord> *changed) {
+  auto it = _chunks.find(cc);
+  if (it == _chunks.end()) {
+    return;
+  }
+  const NavChunk &nav = it->second;
+  auto above = _chunks.find(NavCoord{cc.x, cc.y + 1, cc.z});
+  for (size_t i = 0; i < nav.cells.size(); ++i) {
+    uint32_t cell = nav.cells[i];
+    int64_t y = cell / (_n * _n);
+    int64_t headroom = nav.headroom[i];
+    bool open = y + 1 + headroom == _n;
+    if (top_only && !open) {
+      continue;
+    }
+    if (open) {
+      // The air continues into the chunk above
+      size_t column = cell % (_n * _n);
+      if (above == _chunks.end() ||
+          above->second.bottom_air[column] >= _n) {
+        headroom = OPEN_HEADROOM;
+      } else {
+        headroom += above->second.bottom_air[column];
+      }
+    }
+
+    NavCoord c = cell_coord(cc, cell);
+    auto node = _nodes.find(c);
+    if (headroom < _clearance) {
+      if (node != _nodes.end()) {
+        _nodes.erase(node);
+        changed->push_back(c);
+      }
+    } else if (node == _nodes.end()) {
+      _nodes.emplace(c, Node{headroom, {}});
+      changed->push_back(c);
+    } else if (node->second.headroom != headroom) {
+      node->second.headroom = headroom;
+      changed->push_back(c);
+    }
+  }
+}
+
+void NavGraph::relink(const std::vector<NavCoord> &changed) {
+  // The nodes that may link to a changed node, in reverse of link_node
+  std::unordered_set<NavCoord, NavCoordHash> dirty;
+  for (const NavCoord &c : changed) {
+    dirty.insert(c);
+    for (const int64_t *d : DIRECTIONS) {
+      for (int64_t y = c.y - _max_step; y <= c.y + _max_drop; ++y) {
+        dirty.insert(NavCoord{c.x + d[0], y, c.z + d[1]});
+      }
+    }
+  }
+  for (const NavCoord &c : dirty) {
+    auto it = _nodes.find(c);
+    if (it != _nodes.end()) {
+      link_node(c, &it->second);
+    }
+  }
+}
+
+void NavGraph::link_node(const NavCoord &coord, Node *node) {
+  node->links.clear();
+  for (const int64_t *d : DIRECTIONS) {
+    // The highest node in reach blocks the ones below it
+    for (int64_t dy = _max_step; dy >= -_max_drop; --dy) {
+      NavCoord c{coord.x + d[0], coord.y + dy, coord.z + d[1]};
+      auto it = _nodes.find(c);
+      if (it == _nodes.end()) {
+        continue;
+      }
+      // The lower end needs room for the agent to pass the ledge
+      bool passable = dy > 0 ? node->headroom >= _clearance + dy
+                             : it->second.headroom >= _clearance - dy;
+      if (passable) {
+        node->links.push_back(c);
+      }
+      break;
+    }
+  }
+}
+
+NavCoord NavGraph::cell_coord(const NavCoord &cc, uint32_t cell) const {
+  int64_t x = cell % _n;
+  int64_t z = cell / _n % _n;
+  int64_t y = cell / (_n * _n);
+  return NavCoord{cc.x * _n + x, cc.y * _n + y, cc.z * _n + z};
+}
+}  // namespace godot
@@ -0,0 +1,158 @@
+#ifndef NAVGRAPH_H
+#define NAVGRAPH_H
+
+#include <cstddef>
+#include <cstdint>
+#include <unordered_map>
+#include <vector>
+
+#include "VoxelFiller.h"
+
+namespace godot {
+
+/**
+ * @brief A voxel in the coordinates of the whole world, chunk * n + local.
+ */
+struct NavCoord {
+  int64_t x, y, z;
+
+  bool operator==(const NavCoord &other) const {
+    return x == other.x && y == other.y && z == other.z;
+  }
+};
+
+struct NavCoordHash {
+  size_t operator()(const NavCoord &c) const {
+    size_t h = std::hash<int64_t>()(c.x);
+    h = h * 31 + std::hash<int64_t>()(c.y);
+    h = h * 31 + std::hash<int64_t>()(c.z);
+    return h;
+  }
+};
+
+/**
+ * @brief The walkable voxels of one chunk, extracted by a worker with
+ * NavGraph::extract.
+ */
+struct NavChunk {
+  /**
+   * @brief The voxel_index of every solid voxel that may be stood on.
+   */
+  std::vector<uint32_t> cells;
+  /**
+   * @brief The air voxels above each cell, up to the top of the chunk.
+   */
+  std::vector<uint8_t> headroom;
+  /**
+   * @brief The air voxels at the bottom of each column, as
+   * VoxelFiller::bottom_air computes them. Gives the headroom of the chunk
+   * below. extract leaves it to the caller, the chunk keeps the only copy
+   * until it is added to the graph.
+   */
+  std::vector<uint8_t> bottom_air;
+};
+
+/**
+ * @brief A graph of the surfaces an agent can walk on, built from the chunks
+ * as they are loaded. A node is a solid voxel with at least clearance air
+ * voxels above it. Nodes link to the neighbouring columns if the agent can
+ * walk over, step up at most max_step voxels or drop at most max_drop voxels.
+ *
+ * Links are only recomputed around the nodes a chunk adds or removes, so
+ * chunks are stitched to their neighbours as they load and unload. Voxels
+ * above an unloaded chunk count as air, like the mesher does. Only used from
+ * the main thread.
+ */
+class NavGraph {
+ public:
+  /**
+   * @brief Clears the graph and sets the chunk size in voxels and the agent
+   * dimensions in voxels.
+   */
+  void configure(size_t chunk_voxels, int64_t clearance, int64_t max_step,
+                 int64_t max_drop);
+
+  /**
+   * @brief Extracts the walkable voxels of a chunk of size^3 blocks indexed
+   * by VoxelFiller::voxel_index. Cells whose headroom reaches the top of the
+   * chunk are kept, the chunk above decides about them. Instantiated for the
+   * sizes Chunk specialises.
+   */
+  template <typename Size>
+  static void extract(const uint8_t *blocks, Size size, int64_t clearance,
+                      NavChunk *nav);
+
+  /**
+   * @brief Adds the nodes of a chunk and links them to the loaded
+   * neighbours. Replaces the chunk if it was added before.
+   */
+  void add_chunk(int64_t x, int64_t y, int64_t z, NavChunk nav);
+
+  /**
+   * @brief Removes the nodes of a chunk and the links to them. Does nothing
+   * if the chunk wasn't added.
+   */
+  void remove_chunk(int64_t x, int64_t y, int64_t z);
+
+  size_t chunk_count() const;
+  size_t node_count() const;
+  bool contains(const NavCoord &node) const;
+  const std::vector<NavCoord> &links(const NavCoord &node) const;
+
+  /**
+   * @brief Looks for the highest node in the column of x, z between y and y
+   * - depth.
+   */
+  bool find_node(int64_t x, int64_t y, int64_t z, int64_t depth,
+                 NavCoord *node) const;
+
+  /**
+   * @brief Finds the shortest path between two nodes with A*, including both
+   * of them. Gives up after visiting max_visited nodes, 0 doesn't limit the
+   * search.
+   */
+  bool find_path(const NavCoord &from, const NavCoord &to,
+                 std::vector<NavCoord> *path, size_t max_visited = 0) const;
+
+ private:
+  struct Node {
+    /**
+     * @brief The air voxels above the node, including the chunks above.
+     */
+    int64_t headroom;
+    std::vector<NavCoord> links;
+  };
+
+  /**
+   * @brief Erases the nodes of a chunk's cells and appends them to changed.
+   */
+  void erase_nodes(const NavCoord &cc, std::vector<NavCoord> *changed);
+
+  /**
+   * @brief Inserts, updates or erases the nodes of a chunk's cells, all of
+   * them or only those whose headroom reaches the chunk above. Appends the
+   * voxels that changed.
+   */
+  void update_nodes(const NavCoord &cc, bool top_only,
+                    std::vector<NavCoord> *changed);
+
+  /**
+   * @brief Recomputes the links of the changed nodes and of the nodes that
+   * may link to them.
+   */
+  void relink(const std::vector<NavCoord> &changed);
+  void link_node(const NavCoord &coord, Node *node);
+
+  NavCoord cell_coord(const NavCoord &cc, uint32_t cell) const;
+
+  int64_t _n = 16;
+  int64_t _clearance = 2;
+  int64_t _max_step = 1;
+  int64_t _max_drop = 3;
+
+  std::unordered_map<NavCoord, NavChunk, NavCoordHash> _chunks;
+  std::unordered_map<NavCoord, Node, NavCoordHash> _nodes;
+};
+}  // namespace godot
+
+#endif  // NAVGRAPH_H
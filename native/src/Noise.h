@@ -0,0 +1,117 @@
+#ifndef NOISE_H
+#define NOISE_H
+
+#include <cstdint>
+
+namespace godot {
+
+/**
+ * @brief Seeded gradient noise that is cheap enough to inline. Gradients are
+ * derived from an integer hash of the lattice coordinates instead of a
+ * permutation table, so sampling has no table lookups or branches and loops
+ * over many samples can be vectorised by the compiler. Samples lie roughly in
+ * [-1, 1]. The noise does not depend on the engine.
+ */
+class Noise {
+ public:
+  explicit Noise(uint32_t seed = 0) : _seed(seed) {}
+
+  uint32_t seed() const { return _seed; }
+
+  /**
+   * @brief 2d gradient noise. The layer decorrelates e.g. the octaves of a
+   * fractal sum that use the same noise.
+   */
+  inline double sample(double x, double z, uint32_t layer = 0) const {
+    int32_t xi = fast_floor(x);
+    int32_t zi = fast_floor(z);
+    double xf = x - xi;
+    double zf = z - zi;
+    uint32_t seed = _seed + layer * 0x9E3779B9u;
+
+    double n00 = gradient(hash(xi, zi, seed), xf, zf);
+    double n10 = gradient(hash(xi + 1, zi, seed), xf - 1, zf);
+    double n01 = gradient(hash(xi, zi + 1, seed), xf, zf - 1);
+    double n11 = gradient(hash(xi + 1, zi + 1, seed), xf - 1, zf - 1);
+
+    double u = fade(xf);
+    double v = fade(zf);
+    double n0 = n00 + (n10 - n00) * u;
+    double n1 = n01 + (n11 - n01) * u;
+    return (n0 + (n1 - n0) * v) * 1.4;
+  }
+
+  /**
+   * @brief 3d gradient noise.
+   */
+  inline double sample(double x, double y, double z, uint32_t layer) const {
+    int32_t xi = fast_floor(x);
+    int32_t yi = fast_floor(y);
+    int32_t zi = fast_floor(z);
+    double xf = x - xi;
+    double yf = y - yi;
+    double zf = z - zi;
+    uint32_t seed = _seed + layer * 0x9E3779B9u;
+
+    double u = fade(xf);
+    double v = fade(yf);
+    double w = fade(zf);
+
+    double n[2];
+    for (int32_t dz = 0; dz < 2; ++dz) {
+      uint32_t seed_z = seed ^ (uint32_t(zi + dz) * 0x165667B1u);
+      double n00 = gradient(hash(xi, yi, seed_z), xf, yf, zf - dz);
+      double n10 = gradient(hash(xi + 1, yi, seed_z), xf - 1, yf, zf - dz);
+      double n01 = gradient(hash(xi, yi + 1, seed_z), xf, yf - 1, zf - dz);
+      double n11 =
+          gradient(hash(xi + 1, yi + 1, seed_z), xf - 1, yf - 1, zf - dz);
+      double n0 = n00 + (n10 - n00) * u;
+      double n1 = n01 + (n11 - n01) * u;
+      n[dz] = n0 + (n1 - n0) * v;
+    }
+    return (n[0] + (n[1] - n[0]) * w) * 1.2;
+  }
+
+ private:
+  static inline int32_t fast_floor(double x) {
+    int32_t i = int32_t(x);
+    return i - (x < i);
+  }
+
+  static inline double fade(double t) {
+    return t * t * t * (t * (t * 6 - 15) + 10);
+  }
+
+  static inline uint32_t hash(int32_t x, int32_t z, uint32_t seed) {
+    uint32_t h = seed ^ (uint32_t(x) * 0x27D4EB2Du);
+    h ^= uint32_t(z) * 0x85EBCA6Bu;
+    h ^= h >> 15;
+    h *= 0x2C1B3C6Du;
+    h ^= h >> 12;
+    h *= 0x297A2D39u;
+    h ^= h >> 15;
+    return h;
+  }
+
+  /**
+   * @brief The dot product of the offset with a pseudo random gradient whose
+   * components are taken from the bits of the hash.
+   */
+  static inline double gradient(uint32_t h, double x, double z) {
+    double gx = double(int32_t(h & 0xFFFF) - 0x8000) / 0x8000;
+    double gz = double(int32_t(h >> 16) - 0x8000) / 0x8000;
+    return gx * x + gz * z;
+  }
+
+  static inline double gradient(uint32_t h, double x, double y, double z) {
+    double gx = double(int32_t(h & 0x3FF) - 0x200) / 0x200;
+    double gy = double(int32_t((h >> 10) & 0x3FF) - 0x200) / 0x200;
+    double gz = double(int32_t((h >> 20) & 0x3FF) - 0x200) / 0x200;
+    return gx * x + gy * y + gz * z;
+  }
+
+  uint32_t _seed;
+};
+}  // namespace godot
+
+#endif  // NOISE_H
@@ -0,0 +1,35 @@
+#include "NoiseGenerator.h"
+
+namespace godot {
+
+NoiseGenerator::NoiseGenerator(Ref<OpenSimplexNoise> noise, double scale)
+    : _noise(noise), _scale(scale) {}
+
+void NoiseGenerator::generate_heights(double x, double z, double step,
+                                      size_t count_x, size_t count_z,
+                                      double *heights) {
+  OpenSimplexNoise *noise = _noise.ptr();
+  for (size_t j = 0; j < count_z; ++j) {
+    for (size_t i = 0; i < count_x; ++i) {
+      heights[i + j * count_x] =
+          noise->get_noise_2d(x + i * step, z + j * step) * _scale;
+    }
+  }
+}
+
+void NoiseGenerator::generate_density(double x, double y, double z,
+                                      double step, size_t count_x,
+                                      size_t count_y, size_t count_z,
+                                      double *density) {
+  OpenSimplexNoise *noise = _noise.ptr();
+  for (size_t k = 0; k < count_z; ++k) {
+    for (size_t j = 0; j < count_y; ++j) {
+      double *row = density + (j + k * count_y) * count_x;
+      for (size_t i = 0; i < count_x; ++i) {
+        row[i] = noise->get_noise_3d(x + i * step, y + j * step, z + k * step) *
+                 _scale;
+      }
+    }
+  }
+}
+}  // namespace godot
@@ -0,0 +1,32 @@
+#ifndef NOISEGENERATOR_H
+#define NOISEGENERATOR_H
+
+#include <Godot.hpp>
+#include <OpenSimplexNoise.hpp>
+
+#include "TerrainGenerator.h"
+
+namespace godot {
+
+/**
+ * @brief Rolling hills made from a single layer of 2d noise. The density is a
+ * layer of 3d noise of the same scale.
+ */
+class NoiseGenerator : public TerrainGenerator {
+ public:
+  NoiseGenerator(Ref<OpenSimplexNoise> noise, double scale = 20);
+
+  void generate_heights(double x, double z, double step, size_t count_x,
+                        size_t count_z, double *heights) override;
+
+  void generate_density(double x, double y, double z, double step,
+                        size_t count_x, size_t count_y, size_t count_z,
+                        double *density) override;
+
+ private:
+  Ref<OpenSimplexNoise> _noise;
+  double _scale;
+};
+}  // namespace godot
+
+#endif  // NOISEGENERATOR_H
@@ -0,0 +1,148 @@
+#include "Region.h"
+
+#include <ArrayMesh.hpp>
+#include <VisualServer.hpp>
+
+#include <algorithm>
+
+namespace godot {
+
+Region::Region() : dirty(false), _visible(true) {}
+
+Region::~Region() { clear_visual_instance(); }
+
+void Region::add_chunk(Chunk *chunk) {
+  _chunks.push_back(chunk);
+  dirty = true;
+}
+
+void Region::remove_chunk(Chunk *chunk) {
+  auto it = std::find(_chunks.begin(), _chunks.end(), chunk);
+  if (it != _chunks.end()) {
+    std::iter_swap(it, _chunks.end() - 1);
+    _chunks.pop_back();
+    dirty = true;
+  }
+}
+
+bool Region::empty() const { return _chunks.empty(); }
+
+void Region::rebuild(Ref<Material> material, RID scenario_rid) {
+  VisualServer *visual = VisualServer::get_singleton();
+  dirty = false;
+
+  size_t num_vertices = 0;
+  size_t num_indices = 0;
+  for (Chunk *c : _chunks) {
+    num_vertices += c->get_mesh_data().data_index;
+    num_indices += c->get_mesh_data().indices_index;
+  }
+  if (num_indices == 0) {
+    clear_visual_instance();
+    return;
+  }
+
+  PoolVector3Array vertices;
+  PoolVector3Array normals;
+  PoolVector2Array uvs;
+  PoolVector2Array uv2s;
+  PoolIntArray indices;
+  vertices.resize(num_vertices);
+  normals.resize(num_vertices);
+  uvs.resize(num_vertices);
+  uv2s.resize(num_vertices);
+  indices.resize(num_indices);
+
+  {
+    PoolVector3Array::Write w_vertices = vertices.write();
+    PoolVector3Array::Write w_normals = normals.write();
+    PoolVector2Array::Write w_uvs = uvs.write();
+    PoolVector2Array::Write w_uv2s = uv2s.write();
+    PoolIntArray::Write w_indices = indices.write();
+
+    size_t v_base = 0;
+    size_t i_base = 0;
+    for (Chunk *c : _chunks) {
+      const Chunk::MeshData &data = c->get_mesh_data();
+      size_t nv = data.data_index;
+      size_t ni = data.indices_index;
+      Vector3 offset = c->position - position;
+
+      PoolVector3Array::Read r_vertices = data.vertices.read();
+      PoolVector3Array::Read r_normals = data.normals.read();
+      PoolVector2Array::Read r_uvs = data.uvs.read();
+      PoolVector2Array::Read r_uv2s = data.uv2s.read();
+      PoolIntArray::Read r_indices = data.indices.read();
+
+      for (size_t i = 0; i < nv; ++i) {
+        w_vertices.ptr()[v_base + i] = r_vertices.ptr()[i] + offset;
+      }
+      std::copy_n(r_normals.ptr(), nv, w_normals.ptr() + v_base);
+      std::copy_n(r_uvs.ptr(), nv, w_uvs.ptr() + v_base);
+      std::copy_n(r_uv2s.ptr(), nv, w_uv2s.ptr() + v_base);
+
+      for (size_t i = 0; i < ni; ++i) {
+        w_indices.ptr()[i_base + i] = r_indices.ptr()[i] + v_base;
+      }
+      v_base += nv;
+      i_base += ni;
+    }
+  }
+
+  Array arrays;
+  arrays.resize(ArrayMesh::ARRAY_MAX);
+  arrays[ArrayMesh::ARRAY_VERTEX] = vertices;
+  arrays[ArrayMesh::ARRAY_NORMAL] = normals;
+  arrays[ArrayMesh::ARRAY_TEX_UV] = uvs;
+  arrays[ArrayMesh::ARRAY_TEX_UV2] = uv2s;
+  arrays[ArrayMesh::ARRAY_INDEX] = indices;
+
+  // Reuse the mesh and instance, so a rebuild only replaces the surface
+  if (_mesh_rid.is_valid()) {
+    visual->mesh_clear(_mesh_rid);
+  } else {
+    _mesh_rid = visual->mesh_create();
+  }
+  visual->mesh_add_surface_from_arrays(
+      _mesh_rid, VisualServer::PRIMITIVE_TRIANGLES, arrays);
+  if (material.is_valid()) {
+    visual->mesh_surface_set_material(_mesh_rid, 0, material->get_rid());
+  }
+
+  if (!_visual_instance.is_valid()) {
+    _visual_instance = visual->instance_create();
+    visual->instance_set_scenario(_visual_instance, scenario_rid);
+    visual->instance_set_base(_visual_instance, _mesh_rid);
+
+    Transform visual_transform;
+    visual_transform.origin = position;
+    visual->instance_set_transform(_visual_instance, visual_transform);
+    if (!_visible) {
+      visual->instance_set_visible(_visual_instance, false);
+    }
+  }
+}
+
+void Region::clear_visual_instance() {
+  VisualServer *visual = VisualServer::get_singleton();
+  if (_visual_instance.is_valid()) {
+    visual->free_rid(_visual_instance);
+    _visual_instance = RID();
+  }
+  if (_mesh_rid.is_valid()) {
+    visual->free_rid(_mesh_rid);
+    _mesh_rid = RID();
+  }
+}
+
+void Region::set_visible(bool visible) {
+  if (visible == _visible) {
+    return;
+  }
+  _visible = visible;
+  if (_visual_instance.is_valid()) {
+    VisualServer::get_singleton()->instance_set_visible(_visual_instance,
+                                                        visible);
+  }
+}
+}  // namespace godot
@@ -0,0 +1,62 @@
+#ifndef REGION_H
+#define REGION_H
+
+#include <Godot.hpp>
+#include <Material.hpp>
+
+#include <vector>
+
+#include "Chunk.h"
+
+namespace godot {
+
+/**
+ * @brief Renders the meshes of a block of neighbouring chunks as a single
+ * mesh, to reduce the number of instances and draw calls. The region copies the
+ * cpu side mesh data of its members, so the members must stay active while
+ * they are part of the region.
+ */
+class Region {
+ public:
+  Region();
+  ~Region();
+
+  void add_chunk(Chunk *chunk);
+  void remove_chunk(Chunk *chunk);
+
+  bool empty() const;
+
+  /**
+   * @brief True if the members changed since the last rebuild.
+   */
+  bool dirty;
+
+  /**
+   * @brief The origin of the region in world space. Member vertices are
+   * stored relative to it.
+   */
+  Vector3 position;
+
+  /**
+   * @brief Recreates the region mesh from the mesh data of all members.
+   */
+  void rebuild(Ref<Material> material, RID scenario_rid);
+
+  void clear_visual_instance();
+
+  /**
+   * @brief Shows or hides the region. The flag is kept across rebuilds.
+   */
+  void set_visible(bool visible);
+
+ private:
+  std::vector<Chunk *> _chunks;
+
+  RID _visual_instance;
+  RID _mesh_rid;
+
+  bool _visible;
+};
+}  // namespace godot
+
+#endif  // REGION_H
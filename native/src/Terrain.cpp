@@ -1,27 +1,64 @@
 #include "Terrain.h"
 
 #include <CSGBox.hpp>
+#include <Camera.hpp>
 #include <Engine.hpp>
 #include <Mesh.hpp>
 #include <OpenSimplexNoise.hpp>
+#include <ProjectSettings.hpp>
 #include <RandomNumberGenerator.hpp>
 #include <Shape.hpp>
 #include <SpatialMaterial.hpp>
 #include <SurfaceTool.hpp>
+#include <Viewport.hpp>
 #include <VisualServer.hpp>
 #include <World.hpp>
+#include <algorithm>
 #include <chrono>
+#include <cmath>
+#include <limits>
 #include <thread>
 
-#include "HeightMap.h"
+#include "FbmGenerator.h"
+#include "IslandGenerator.h"
+#include "NoiseGenerator.h"
+#include "Trace.h"
 #include "Utils.h"
+#include "VoxelFiller.h"
 
 namespace godot {
 
+namespace {
+/**
+ * @brief Integer division rounding towards negative infinity.
+ */
+int64_t floor_div(int64_t a, int64_t b) {
+  return a >= 0 ? a / b : -((-a + b - 1) / b);
+}
+}  // namespace
+
 void Terrain::_register_methods() {
   register_method("_ready", &Terrain::_ready);
   register_method("_process", &Terrain::_process);
+  register_method("_exit_tree", &Terrain::_exit_tree);
   register_method("process_chunks", &Terrain::process_chunks);
+  register_method("get_statistics", &Terrain::get_statistics);
+  register_method("get_memory_usage", &Terrain::get_memory_usage);
+  register_method("add_observer", &Terrain::add_observer);
+  register_method("remove_observer", &Terrain::remove_observer);
+  register_method("raycast", &Terrain::raycast);
+  register_method("raycast_batch", &Terrain::raycast_batch);
+  register_method("get_block_at", &Terrain::get_block_at);
+  register_method("is_solid", &Terrain::is_solid);
+  register_method("is_solid_batch", &Terrain::is_solid_batch);
+  register_method("is_box_occupied", &Terrain::is_box_occupied);
+  register_method("get_surface_height", &Terrain::get_surface_height);
+  register_method("get_surface_height_batch",
+                  &Terrain::get_surface_height_batch);
+  register_method("find_path", &Terrain::find_path);
+  register_method("start_trace", &Terrain::start_trace);
+  register_method("stop_trace", &Terrain::stop_trace);
+  register_method("dump_trace", &Terrain::dump_trace);
 
   register_property<Terrain, NodePath>("Player Path", &Terrain::_player_path,
                                        "Player");
@@ -33,23 +70,103 @@ void Terrain::_register_methods() {
 
   register_property<Terrain, int64_t>("World Floor", &Terrain::_floor, -3);
   register_property<Terrain, int64_t>("World Ceiling", &Terrain::_ceiling, 3);
+  register_property<Terrain, int64_t>("Seed", &Terrain::_seed, 0);
+  register_property<Terrain, bool>("Random Seed", &Terrain::_random_seed,
+                                   true);
+  register_property<Terrain, int64_t>(
+      "Generator", &Terrain::_generator_type, GENERATOR_NOISE,
+      GODOT_METHOD_RPC_MODE_DISABLED, GODOT_PROPERTY_USAGE_DEFAULT,
+      GODOT_PROPERTY_HINT_ENUM, "Noise,Island,Hills,Mountains,Canyons");
+  register_property<Terrain, int64_t>("Island Size", &Terrain::_island_size,
+                                      512);
+  register_property<Terrain, double>("Island Height", &Terrain::_island_height,
+                                     32);
+  register_property<Terrain, bool>("3D Density", &Terrain::_density, false);
+  register_property<Terrain, String>(
+      "Baked World", &Terrain::_baked_world_path, String(),
+      GODOT_METHOD_RPC_MODE_DISABLED, GODOT_PROPERTY_USAGE_DEFAULT,
+      GODOT_PROPERTY_HINT_FILE, "*.vxb");
+  register_property<Terrain, Ref<TextureArray>>(
+      "Block Textures", &Terrain::_block_textures, Ref<TextureArray>(),
+      GODOT_METHOD_RPC_MODE_DISABLED, GODOT_PROPERTY_USAGE_DEFAULT,
+      GODOT_PROPERTY_HINT_RESOURCE_TYPE, "TextureArray");
+
+  register_property<Terrain, bool>("Keep Mesh Data", &Terrain::_keep_mesh_data,
+                                   false);
+  register_property<Terrain, bool>("Navigation", &Terrain::_navigation,
+                                   false);
+  register_property<Terrain, int64_t>("Nav Clearance",
+                                      &Terrain::_nav_clearance, 2);
+  register_property<Terrain, int64_t>("Nav Max Step", &Terrain::_nav_max_step,
+                                      1);
+  register_property<Terrain, int64_t>("Nav Max Drop", &Terrain::_nav_max_drop,
+                                      3);
+  register_property<Terrain, bool>("Decorate", &Terrain::_decorate, false);
+  register_property<Terrain, double>("Decoration Density",
+                                     &Terrain::_decoration_density, 1);
+  register_property<Terrain, Ref<Mesh>>(
+      "Grass Mesh", &Terrain::_grass_mesh, Ref<Mesh>(),
+      GODOT_METHOD_RPC_MODE_DISABLED, GODOT_PROPERTY_USAGE_DEFAULT,
+      GODOT_PROPERTY_HINT_RESOURCE_TYPE, "Mesh");
+  register_property<Terrain, Ref<Mesh>>(
+      "Rock Mesh", &Terrain::_rock_mesh, Ref<Mesh>(),
+      GODOT_METHOD_RPC_MODE_DISABLED, GODOT_PROPERTY_USAGE_DEFAULT,
+      GODOT_PROPERTY_HINT_RESOURCE_TYPE, "Mesh");
+  register_property<Terrain, Ref<Mesh>>(
+      "Tree Mesh", &Terrain::_tree_mesh, Ref<Mesh>(),
+      GODOT_METHOD_RPC_MODE_DISABLED, GODOT_PROPERTY_USAGE_DEFAULT,
+      GODOT_PROPERTY_HINT_RESOURCE_TYPE, "Mesh");
+  register_property<Terrain, bool>("Share Meshes", &Terrain::_share_meshes,
+                                   true);
+  register_property<Terrain, int64_t>("Max Pooled Chunks",
+                                      &Terrain::_max_pooled_chunks, 256);
+  register_property<Terrain, double>("Memory Budget MB",
+                                     &Terrain::_memory_budget_mb, 0);
+
+  register_property<Terrain, bool>("Batch Regions", &Terrain::_batch_regions,
+                                   false);
+  register_property<Terrain, int64_t>("Region Size", &Terrain::_region_size,
+                                      4);
+  register_property<Terrain, int64_t>("Region Rebuilds Per Frame",
+                                      &Terrain::_region_rebuilds_per_frame, 2);
+  register_property<Terrain, bool>("Occlusion Culling",
+                                   &Terrain::_occlusion_culling, false);
+  register_property<Terrain, bool>("Prefetch", &Terrain::_prefetch, false);
+  register_property<Terrain, double>("Prefetch Time", &Terrain::_prefetch_time,
+                                     1.5);
+  register_property<Terrain, double>("Prefetch Bias", &Terrain::_prefetch_bias,
+                                     2);
+
+  register_property<Terrain, int64_t>("Min Workers", &Terrain::_min_workers, 1);
+  register_property<Terrain, int64_t>("Max Workers", &Terrain::_max_workers, 0);
+  register_property<Terrain, int64_t>("Reserved Cores",
+                                      &Terrain::_reserved_cores, 2);
+  register_property<Terrain, double>("Frame Budget MS",
+                                     &Terrain::_frame_budget_ms, 20);
+  register_property<Terrain, int64_t>("Max Height Jobs",
+                                      &Terrain::_max_height_jobs, 0);
+  register_property<Terrain, int64_t>("Max Voxel Jobs",
+                                      &Terrain::_max_voxel_jobs, 0);
+  register_property<Terrain, int64_t>("Max Mesh Jobs",
+                                      &Terrain::_max_mesh_jobs, 0);
+  register_property<Terrain, bool>("Async Startup", &Terrain::_async_startup,
+                                   false);
+
+  register_signal<Terrain>("load_progress", "loaded", GODOT_VARIANT_TYPE_INT,
+                           "total", GODOT_VARIANT_TYPE_INT);
+  register_signal<Terrain>("terrain_ready", Dictionary());
 }
 
 Terrain::Terrain() : Spatial(), _floor(-3), _ceiling(3) {
-  _available_chunks = Semaphore::_new();
-  _chunks_to_load_mutex = Mutex::_new();
   _loaded_chunks_mutex = Mutex::_new();
   _chunk_pool_mutex = Mutex::_new();
   _noise = Ref<OpenSimplexNoise>(OpenSimplexNoise::_new());
-
-  Ref<RandomNumberGenerator> rng(RandomNumberGenerator::_new());
-  rng->randomize();
-  _noise->set_seed(rng->randi());
 }
 
 Terrain::~Terrain() {
-  _available_chunks->free();
-  _chunks_to_load_mutex->free();
+  for (std::pair<const ChunkCoord, Region *> &p : _regions) {
+    delete p.second;
+  }
   _loaded_chunks_mutex->free();
   _chunk_pool_mutex->free();
 }
@@ -62,9 +179,41 @@ void Terrain::_ready() {
   //  VisualServer *visual = VisualServer::get_singleton();
   //  visual->connect("frame_pre_draw", this, "on_pre_draw");
 
-  for (size_t i = 0; i < std::thread::hardware_concurrency(); ++i) {
-    Thread *thread = Thread::_new();
-    thread->start(this, "process_chunks");
+  if (!_baked_world_path.empty()) {
+    load_baked_world();
+  }
+  if (_random_seed) {
+    Ref<RandomNumberGenerator> rng(RandomNumberGenerator::_new());
+    rng->randomize();
+    _seed = rng->randi();
+  }
+  _noise->set_seed(_seed);
+  create_generator();
+  VOXEL_TRACE_THREAD_NAME("main");
+
+  if (_block_textures.is_null()) {
+    _block_textures = create_default_block_textures();
+  }
+  _material = create_block_material(_block_textures);
+  _mesh_cache.set_material(_material);
+  _nav_graph.configure(_chunk_num_blocks, _nav_clearance, _nav_max_step,
+                       _nav_max_drop);
+  _open_air.assign(_chunk_num_blocks * _chunk_num_blocks, 255);
+
+  // One thread per worker that may become active, the controller in
+  // update_worker_count decides how many of them build
+  int64_t cores = std::max<int64_t>(1, std::thread::hardware_concurrency());
+  int64_t max_workers =
+      _max_workers > 0 ? _max_workers : cores - _reserved_cores;
+  max_workers = std::max<int64_t>(1, max_workers);
+  int64_t min_workers =
+      std::max<int64_t>(1, std::min(_min_workers, max_workers));
+  _active_workers = std::max(min_workers, max_workers / 2);
+  _last_frame = std::chrono::steady_clock::now();
+  _last_worker_update = _last_frame;
+  for (int64_t i = 0; i < max_workers; ++i) {
+    Ref<Thread> thread(Thread::_new());
+    thread->start(this, "process_chunks", i);
 
     _worker_threads.push_back(thread);
   }
@@ -72,33 +221,66 @@ void Terrain::_ready() {
   _player = (Spatial *)get_node_or_null(_player_path);
   if (_player == nullptr) {
     Godot::print("Unable to locate the player at " + _player_path);
+    return;
   }
 
-  // Initialize the terrain
+  // Initialize the terrain. Only chunks the player retains are built, nothing
+  // would unload the others. In async mode the workers build them and
+  // _process reports the progress.
   Vector3 player_pos = _player->get_global_transform().origin;
-  int64_t co_x = player_pos.x / _chunk_size;
-  int64_t co_z = player_pos.z / _chunk_size;
+  ChunkCoord player_cc{int64_t(player_pos.x / _chunk_size),
+                       int64_t(player_pos.y / _chunk_size),
+                       int64_t(player_pos.z / _chunk_size)};
+  ChunkBox retained = chunk_box(player_cc, int64_t(1.5 * _loaded_radius));
   for (int64_t y = _floor; y <= _ceiling; y++) {
-    for (int64_t x = co_x - INIT_LOADED_RADIUS; x <= co_x + INIT_LOADED_RADIUS;
-         x++) {
-      for (int64_t z = co_z - INIT_LOADED_RADIUS;
-           z <= co_z + INIT_LOADED_RADIUS; z++) {
+    for (int64_t x = player_cc.x - INIT_LOADED_RADIUS;
+         x <= player_cc.x + INIT_LOADED_RADIUS; x++) {
+      for (int64_t z = player_cc.z - INIT_LOADED_RADIUS;
+           z <= player_cc.z + INIT_LOADED_RADIUS; z++) {
         ChunkCoord cc{x, y, z};
-        if (_chunks.count(cc) == 0) {
-          load_chunk_sequential(x, y, z);
+        if (_chunks.count(cc) == 0 && retained.contains(cc)) {
+          if (_async_startup) {
+            load_chunk(x, y, z);
+            _startup_chunks.insert(cc);
+          } else {
+            load_chunk_sequential(x, y, z);
+          }
+          _startup_total++;
         }
       }
     }
   }
+  _starting_up = true;
+  if (!_startup_chunks.empty()) {
+    // Nothing competes with the loading screen for the cores, so every worker
+    // builds until the terrain is ready
+    {
+      std::lock_guard<std::mutex> lock(_jobs_mutex);
+      _active_workers = int64_t(_worker_threads.size());
+    }
+    _jobs_condition.notify_all();
+  }
+  add_observer(_player, _loaded_radius);
 }
 
 void Terrain::_process(float delta) {
   using namespace std::chrono;
+  // How long chunks may be integrated per frame during an async startup
+  constexpr milliseconds STARTUP_INTEGRATION_TIME(8);
 
-  //  time_point start_time = high_resolution_clock::now();
+  steady_clock::time_point start_time = steady_clock::now();
+  VOXEL_TRACE_SCOPE("process", 0, 0, 0);
 
+  // While starting up the chunks are integrated in bulk, but only for so long
+  // that a loading screen keeps animating
+  bool bulk = !_startup_chunks.empty();
   _loaded_chunks_mutex->lock();
-  for (size_t i = 0; i < 2 && !_loaded_chunks.empty(); ++i) {
+  for (size_t i = 0; !_loaded_chunks.empty(); ++i) {
+    bool over_time =
+        steady_clock::now() - start_time > STARTUP_INTEGRATION_TIME;
+    if (i >= 2 && (!bulk || over_time)) {
+      break;
+    }
     Chunk *c = _loaded_chunks.back();
     _loaded_chunks.pop_back();
 
@@ -106,12 +288,19 @@ void Terrain::_process(float delta) {
     ChunkCoord cc{int64_t(std::round(c->position.x / _chunk_size)),
                   int64_t(std::round(c->position.y / _chunk_size)),
                   int64_t(std::round(c->position.z / _chunk_size))};
+    VOXEL_TRACE_SCOPE("integrate", cc.x, cc.y, cc.z);
     if (_chunks.count(cc) > 0 && _chunks[cc] == c) {
-      if (!c->empty) {
-        c->update_tree();
-        c->set_state(Chunk::State::ACTIVE);
-      }
+      _chunk_latencies.push_back(
+          duration_cast<microseconds>(start_time - c->request_time).count() /
+          1000.0);
+      // Empty chunks are activated as well, so they are pooled again when
+      // they are unloaded.
+      activate_chunk(cc, c);
+      _startup_chunks.erase(cc);
     } else {
+      // The chunk was unloaded after its build finished
+      VOXEL_TRACE_INSTANT("stale", cc.x, cc.y, cc.z);
+      _stale_builds++;
       c->set_state(Chunk::State::UNUSED);
       // Remove the chunk from the scene
       c->unload();
@@ -124,139 +313,1295 @@ void Terrain::_process(float delta) {
   }
   _loaded_chunks_mutex->unlock();
 
-  Vector3 player_pos = _player->get_global_transform().origin;
-  int64_t co_x = player_pos.x / _chunk_size;
-  int64_t co_y = player_pos.y / _chunk_size;
-  int64_t co_z = player_pos.z / _chunk_size;
+  trim_chunk_pool();
+  rebuild_regions();
 
-  {
-    std::vector<ChunkCoord> to_remove;
-    for (const std::pair<ChunkCoord, Chunk *> &p : _chunks) {
-      if (std::abs(p.first.x - co_x) > 1.5 * _loaded_radius ||
-          std::abs(p.first.y - co_y) > 1.5 * _loaded_radius ||
-          std::abs(p.first.z - co_z) > 1.5 * _loaded_radius) {
-        to_remove.push_back(p.first);
-      }
-    }
-    for (ChunkCoord &c : to_remove) {
-      unload_chunk(c.x, c.y, c.z);
+  if (_occlusion_culling) {
+    update_occlusion();
+  }
+
+  bool reprioritize = false;
+  for (Observer &observer : _observers) {
+    reprioritize |= update_observer(observer, delta);
+  }
+  if (_prefetch && reprioritize) {
+    prioritize_chunks_to_load();
+  }
+  if (reprioritize && !_startup_chunks.empty()) {
+    prioritize_startup_chunks();
+  }
+
+  update_startup_progress();
+  update_worker_count();
+
+  _process_usec =
+      duration_cast<microseconds>(steady_clock::now() - start_time).count();
+}
+
+void Terrain::_exit_tree() { stop_workers(); }
+
+void Terrain::update_worker_count() {
+  using namespace std::chrono;
+  constexpr milliseconds UPDATE_INTERVAL(250);
+
+  steady_clock::time_point now = steady_clock::now();
+  double frame_ms = duration<double, std::milli>(now - _last_frame).count();
+  _last_frame = now;
+  // Smooth over a few frames, a single hitch shouldn't park a worker
+  _frame_ms = _frame_ms * 0.9 + frame_ms * 0.1;
+  // All workers stay active until the startup volume is loaded
+  if (now - _last_worker_update < UPDATE_INTERVAL ||
+      _worker_threads.empty() || !_startup_chunks.empty()) {
+    return;
+  }
+  _last_worker_update = now;
+
+  _jobs_mutex.lock();
+  int64_t queued = _chunks_to_load.size() + _chunks_to_mesh.size();
+  _jobs_mutex.unlock();
+
+  int64_t max_workers = _worker_threads.size();
+  int64_t min_workers =
+      std::max<int64_t>(1, std::min(_min_workers, max_workers));
+  int64_t active = _active_workers.load();
+  if (_frame_ms > _frame_budget_ms && active > min_workers) {
+    // The workers compete with the engine's threads
+    active--;
+  } else if (_frame_ms < _frame_budget_ms * 0.8 && queued > active &&
+             active < max_workers) {
+    active++;
+  } else if (queued == 0 && active > min_workers) {
+    active--;
+  }
+
+  if (active != _active_workers.load()) {
+    {
+      std::lock_guard<std::mutex> lock(_jobs_mutex);
+      _active_workers = active;
     }
+    _jobs_condition.notify_all();
+  }
+}
+
+void Terrain::update_startup_progress() {
+  if (!_starting_up) {
+    return;
+  }
+  int64_t loaded = _startup_total - int64_t(_startup_chunks.size());
+  if (loaded != _startup_loaded) {
+    _startup_loaded = loaded;
+    emit_signal("load_progress", loaded, _startup_total);
   }
+  if (_startup_chunks.empty()) {
+    VOXEL_TRACE_INSTANT("terrain_ready", 0, 0, 0);
+    _starting_up = false;
+    emit_signal("terrain_ready");
+  }
+}
 
-  ChunkCoord player_cc{co_x, co_y, co_z};
-  if (_chunks.count(player_cc) == 0 && co_y >= _floor && co_y <= _ceiling) {
-    load_chunk_sequential(co_x, co_y, co_z);
+void Terrain::prioritize_startup_chunks() {
+  _jobs_mutex.lock();
+  std::stable_partition(
+      _chunks_to_load.begin(), _chunks_to_load.end(), [&](Chunk *c) {
+        ChunkCoord cc{int64_t(std::round(c->position.x / _chunk_size)),
+                      int64_t(std::round(c->position.y / _chunk_size)),
+                      int64_t(std::round(c->position.z / _chunk_size))};
+        return _startup_chunks.count(cc) == 0;
+      });
+  _jobs_mutex.unlock();
+}
+
+void Terrain::stop_workers() {
+  {
+    std::lock_guard<std::mutex> lock(_jobs_mutex);
+    _stopping_workers = true;
+  }
+  _jobs_condition.notify_all();
+  for (Ref<Thread> &thread : _worker_threads) {
+    thread->wait_to_finish();
   }
+  _worker_threads.clear();
+}
 
-  for (int64_t y = co_y - _loaded_radius; y <= co_y + _loaded_radius; y++) {
-    if (y < _floor || y > _ceiling) {
-      continue;
+Dictionary Terrain::get_statistics() {
+  Dictionary stats;
+  stats["process_usec"] = _process_usec;
+  stats["active_chunks"] = int64_t(_chunks.size());
+
+  _jobs_mutex.lock();
+  stats["queue_depth"] = int64_t(_chunks_to_load.size());
+  stats["mesh_queue_depth"] = int64_t(_chunks_to_mesh.size());
+  stats["cached_columns"] = int64_t(_columns.size());
+  _jobs_mutex.unlock();
+
+  _loaded_chunks_mutex->lock();
+  stats["integration_queue_depth"] = int64_t(_loaded_chunks.size());
+  _loaded_chunks_mutex->unlock();
+
+  _chunk_pool_mutex->lock();
+  stats["pooled_chunks"] = int64_t(_chunk_pool.size());
+  _chunk_pool_mutex->unlock();
+
+  stats["cancelled_builds"] = int64_t(_cancelled_builds.load());
+  stats["stale_builds"] = int64_t(_stale_builds.load());
+  stats["active_workers"] = _active_workers.load();
+  stats["observers"] = int64_t(_observers.size());
+  stats["retained_chunks"] = int64_t(_chunk_refs.size());
+  stats["nav_nodes"] = int64_t(_nav_graph.node_count());
+
+  PoolRealArray latencies;
+  latencies.resize(_chunk_latencies.size());
+  for (size_t i = 0; i < _chunk_latencies.size(); ++i) {
+    latencies.set(i, _chunk_latencies[i]);
+  }
+  _chunk_latencies.clear();
+  stats["chunk_latencies_ms"] = latencies;
+  return stats;
+}
+
+void Terrain::process_chunks(int64_t index) {
+  VOXEL_TRACE_THREAD_NAME("worker");
+  std::unique_lock<std::mutex> lock(_jobs_mutex);
+  while (true) {
+    Job job;
+    _jobs_condition.wait(lock, [&]() {
+      return _stopping_workers.load() ||
+             (index < _active_workers.load() && next_job(&job));
+    });
+    if (_stopping_workers.load()) {
+      return;
     }
-    for (int64_t x = co_x - _loaded_radius; x <= co_x + _loaded_radius; x++) {
-      for (int64_t z = co_z - _loaded_radius; z <= co_z + _loaded_radius; z++) {
-        ChunkCoord cc{x, y, z};
-        if (_chunks.count(cc) == 0) {
-          load_chunk(x, y, z);
-        }
+    _running_jobs[job.stage]++;
+    lock.unlock();
+
+    bool done = run_job(job);
+
+    lock.lock();
+    _running_jobs[job.stage]--;
+    finish_job(job, done);
+    // The next stage of the chunk, or jobs held back by the stage's limit,
+    // may be ready now
+    _jobs_condition.notify_all();
+  }
+}
+
+bool Terrain::can_start(Stage stage) const {
+  int64_t limit = 0;
+  switch (stage) {
+    case STAGE_HEIGHTS:
+      limit = _max_height_jobs;
+      break;
+    case STAGE_VOXELS:
+      limit = _max_voxel_jobs;
+      break;
+    case STAGE_MESH:
+      limit = _max_mesh_jobs;
+      break;
+    default:
+      break;
+  }
+  return limit <= 0 || _running_jobs[stage] < limit;
+}
+
+bool Terrain::next_job(Job *job) {
+  if (!_chunks_to_mesh.empty() && can_start(STAGE_MESH)) {
+    *job = _chunks_to_mesh.back();
+    _chunks_to_mesh.pop_back();
+    return true;
+  }
+
+  bool voxels = can_start(STAGE_VOXELS);
+  bool heights = can_start(STAGE_HEIGHTS);
+  // The most urgent chunk whose next stage may run. A chunk whose column is
+  // still sampled is passed over for the chunks behind it.
+  for (size_t i = _chunks_to_load.size(); i-- > 0 && (voxels || heights);) {
+    Chunk *chunk = _chunks_to_load[i];
+    auto it = _chunk_columns.find(chunk);
+    Column *column = it != _chunk_columns.end() ? it->second : nullptr;
+    if (column == nullptr || column->state == Column::State::READY) {
+      if (!voxels) {
+        continue;
       }
+      _chunks_to_load.erase(_chunks_to_load.begin() + i);
+      if (column != nullptr) {
+        // The job holds the reference from now on
+        _chunk_columns.erase(it);
+      }
+      chunk->set_state(Chunk::State::BUILDING);
+      job->stage = STAGE_VOXELS;
+      job->chunk = chunk;
+      job->column = column;
+      job->generation = chunk->get_generation();
+      return true;
+    }
+    if (column->state == Column::State::WAITING && heights) {
+      column->state = Column::State::SAMPLING;
+      column->references++;
+      job->stage = STAGE_HEIGHTS;
+      job->chunk = nullptr;
+      job->column = column;
+      job->generation = 0;
+      return true;
     }
   }
-
-  //  time_point end_time = high_resolution_clock::now();
-  //  double time_ms = duration_cast<microseconds>(end_time -
-  //  start_time).count() / 1000.0; Godot::print("Update time: " +
-  //  String::num(time_ms, 3));
+  return false;
 }
 
-void Terrain::process_chunks() {
-  using namespace std::chrono;
-  while (true) {
-    _available_chunks->wait();
-    _chunks_to_load_mutex->lock();
-    if (_chunks_to_load.empty()) {
-      _chunks_to_load_mutex->unlock();
-      continue;
+bool Terrain::run_job(const Job &job) {
+  switch (job.stage) {
+    case STAGE_HEIGHTS: {
+      Column *column = job.column;
+      VOXEL_TRACE_SCOPE("heights", column->cc.x, 0, column->cc.z);
+      // No other job reads the heights before the column is ready
+      column->heights.resize(VoxelFiller::height_count(_chunk_num_blocks));
+      VoxelFiller::sample_heights(_generator.get(), column->cc.x * _chunk_size,
+                                  column->cc.z * _chunk_size, _chunk_size,
+                                  _chunk_num_blocks, column->heights.data());
+      return true;
+    }
+    case STAGE_VOXELS: {
+      const double *heights =
+          job.column != nullptr ? job.column->heights.data() : nullptr;
+      job.chunk->lock();
+      bool built = job.chunk->build_voxels(job.generation, heights);
+      job.chunk->unlock();
+      return built;
     }
-    Chunk *to_load = _chunks_to_load.back();
-    _chunks_to_load.pop_back();
-    to_load->set_state(Chunk::State::BUILDING);
-    _chunks_to_load_mutex->unlock();
+    case STAGE_MESH: {
+      job.chunk->lock();
+      // The voxel stage may have run on another thread, the blocks are
+      // unpacked once for all builds of the stage
+      const uint8_t *blocks = job.chunk->unpack_voxels();
+      bool built = job.chunk->build_mesh(job.generation, blocks);
+      if (built && _navigation) {
+        built = job.chunk->build_navigation(job.generation, blocks,
+                                            _nav_clearance);
+      }
+      if (built && _decorate) {
+        built = job.chunk->build_decorations(job.generation, blocks, _seed,
+                                             _decoration_density);
+      }
+      job.chunk->unlock();
+      return built;
+    }
+    default:
+      return false;
+  }
+}
+
+void Terrain::finish_job(const Job &job, bool done) {
+  if (job.stage == STAGE_HEIGHTS) {
+    job.column->state = Column::State::READY;
+    release_column(job.column);
+    return;
+  }
+  if (job.column != nullptr) {
+    release_column(job.column);
+  }
+
+  Chunk *chunk = job.chunk;
+  // unload_chunk cancels under _jobs_mutex, so a build cancelled after its
+  // last check is caught here and never reaches _loaded_chunks
+  if (!done || chunk->get_generation() != job.generation) {
+    // The chunk was unloaded while building. It never reached the scene, so
+    // it can go straight back to the pool.
+    VOXEL_TRACE_INSTANT("cancelled", chunk->position.x / _chunk_size,
+                        chunk->position.y / _chunk_size,
+                        chunk->position.z / _chunk_size);
+    _cancelled_builds++;
+    chunk->release_data();
+    chunk->set_state(Chunk::State::UNUSED);
+    _chunk_pool_mutex->lock();
+    _chunk_pool.push_back(chunk);
+    _chunk_pool_mutex->unlock();
+    return;
+  }
 
-    to_load->lock();
-    to_load->build_terrain();
-    to_load->unlock();
+  if (job.stage == STAGE_VOXELS) {
+    Job mesh = job;
+    mesh.stage = STAGE_MESH;
+    mesh.column = nullptr;
+    _chunks_to_mesh.push_back(mesh);
+    VOXEL_TRACE_COUNTER("mesh_queue_depth", _chunks_to_mesh.size());
+    return;
+  }
 
-    _loaded_chunks_mutex->lock();
-    _loaded_chunks.push_back(to_load);
-    _loaded_chunks_mutex->unlock();
+  _loaded_chunks_mutex->lock();
+  _loaded_chunks.push_back(chunk);
+  VOXEL_TRACE_COUNTER("integration_queue_depth", _loaded_chunks.size());
+  _loaded_chunks_mutex->unlock();
+}
+
+void Terrain::release_column(Chunk *chunk) {
+  auto it = _chunk_columns.find(chunk);
+  if (it == _chunk_columns.end()) {
+    return;
   }
+  Column *column = it->second;
+  _chunk_columns.erase(it);
+  release_column(column);
+}
+
+void Terrain::release_column(Column *column) {
+  if (--column->references > 0) {
+    return;
+  }
+  _columns.erase(column->cc);
 }
 
 void Terrain::load_chunk(int64_t x, int64_t y, int64_t z) {
+  VOXEL_TRACE_INSTANT("enqueue", x, y, z);
   ChunkCoord cc{x, y, z};
   Chunk *chunk = acquire_chunk();
   chunk->lock();
-  _chunks[cc] = chunk;
+  {
+    std::unique_lock<std::shared_mutex> lock(_chunks_lock);
+    _chunks[cc] = chunk;
+  }
 
   chunk->position = Vector3(x * _chunk_size, y * _chunk_size, z * _chunk_size);
+  chunk->request_time = std::chrono::steady_clock::now();
   Transform t;
   t.origin = chunk->position;
   chunk->unlock();
 
-  _chunks_to_load_mutex->lock();
-  _chunks_to_load.push_back(chunk);
-  _chunks_to_load_mutex->unlock();
-  _available_chunks->post();
+  {
+    std::lock_guard<std::mutex> lock(_jobs_mutex);
+    _chunks_to_load.push_back(chunk);
+    VOXEL_TRACE_COUNTER("queue_depth", _chunks_to_load.size());
+    // Baked chunks are read, not generated
+    if (_baked_world == nullptr || !_baked_world->contains(x, y, z)) {
+      std::unique_ptr<Column> &column = _columns[ChunkCoord{x, 0, z}];
+      if (column == nullptr) {
+        column.reset(new Column());
+        column->cc = ChunkCoord{x, 0, z};
+      }
+      column->references++;
+      _chunk_columns[chunk] = column.get();
+    }
+  }
+  // Parked workers ignore the notification, so wake them all
+  _jobs_condition.notify_all();
 }
 
 void Terrain::load_chunk_sequential(int64_t x, int64_t y, int64_t z) {
+  VOXEL_TRACE_SCOPE("load_sequential", x, y, z);
   ChunkCoord cc{x, y, z};
   Chunk *chunk = acquire_chunk();
   chunk->set_state(Chunk::State::BUILDING);
   chunk->lock();
-  _chunks[cc] = chunk;
+  {
+    std::unique_lock<std::shared_mutex> lock(_chunks_lock);
+    _chunks[cc] = chunk;
+  }
 
   chunk->position = Vector3(x * _chunk_size, y * _chunk_size, z * _chunk_size);
+  chunk->request_time = std::chrono::steady_clock::now();
   Transform t;
   t.origin = chunk->position;
 
-  chunk->build_terrain();
+  uint64_t generation = chunk->get_generation();
+  chunk->build_voxels(generation, nullptr);
+  const uint8_t *blocks = chunk->unpack_voxels();
+  chunk->build_mesh(generation, blocks);
+  if (_navigation) {
+    chunk->build_navigation(generation, blocks, _nav_clearance);
+  }
+  if (_decorate) {
+    chunk->build_decorations(generation, blocks, _seed, _decoration_density);
+  }
 
-  chunk->update_tree();
-  chunk->set_state(Chunk::State::ACTIVE);
+  activate_chunk(cc, chunk);
   chunk->unlock();
+
+  _chunk_latencies.push_back(
+      std::chrono::duration_cast<std::chrono::microseconds>(
+          std::chrono::steady_clock::now() - chunk->request_time)
+          .count() /
+      1000.0);
 }
 
 void Terrain::unload_chunk(int64_t x, int64_t y, int64_t z) {
+  VOXEL_TRACE_SCOPE("unload", x, y, z);
   ChunkCoord cc{x, y, z};
   auto it = _chunks.find(cc);
-  _chunks.erase(it);
+  Chunk *chunk = it->second;
+  // The player moved away before the startup volume finished loading
+  _startup_chunks.erase(cc);
+  {
+    // Queries must not see the chunk anymore once it is deactivated
+    std::unique_lock<std::shared_mutex> lock(_chunks_lock);
+    _chunks.erase(it);
+  }
 
   // Check if the chunk was scheduled for loading and unschedule it
-  _chunks_to_load_mutex->lock();
-  for (size_t i = 0; i < _chunks_to_load.size(); ++i) {
-    if (_chunks_to_load[i] == it->second) {
-      std::iter_swap(_chunks_to_load.begin() + i, _chunks_to_load.end() - 1);
-      _chunks_to_load.pop_back();
-    }
+  _jobs_mutex.lock();
+  auto queued =
+      std::find(_chunks_to_load.begin(), _chunks_to_load.end(), chunk);
+  if (queued != _chunks_to_load.end()) {
+    _chunks_to_load.erase(queued);
+    release_column(chunk);
   }
-  Chunk::State s = it->second->get_state();
-  _chunks_to_load_mutex->unlock();
+  auto meshing =
+      std::find_if(_chunks_to_mesh.begin(), _chunks_to_mesh.end(),
+                   [&](const Job &job) { return job.chunk == chunk; });
+  if (meshing != _chunks_to_mesh.end()) {
+    // No worker holds the chunk between its stages
+    _chunks_to_mesh.erase(meshing);
+    chunk->set_state(Chunk::State::UNUSED);
+  }
+  // Stop a running build at its next stage
+  chunk->cancel();
+  Chunk::State s = chunk->get_state();
+  _jobs_mutex.unlock();
 
   if (s == Chunk::State::BUILDING) {
     // The chunk is still being constructed from the time it was loaded
-    // abort. The chunk will be readded to the pool once it was fully loaded.
+    // abort. The worker returns the chunk to the pool when its job finishes.
     return;
   }
 
   // Remove the chunk from the scene
-  it->second->unload();
+  deactivate_chunk(cc, chunk);
+
+  // The chunk can now be reused. Queries must not take its voxels as valid
+  // before it is built again.
+  chunk->set_state(Chunk::State::UNUSED);
+
+  _chunk_pool_mutex->lock();
+  _chunk_pool.push_back(chunk);
+  _chunk_pool_mutex->unlock();
+}
+
+void Terrain::release_chunk(const ChunkCoord &cc) {
+  auto it = _chunk_refs.find(cc);
+  if (--it->second > 0) {
+    return;
+  }
+  _chunk_refs.erase(it);
+  if (_chunks.count(cc) > 0) {
+    unload_chunk(cc.x, cc.y, cc.z);
+  }
+}
+
+void Terrain::add_observer(Spatial *node, int64_t radius) {
+  if (node == nullptr) {
+    return;
+  }
+  if (radius <= 0) {
+    radius = _loaded_radius;
+  }
+  for (Observer &observer : _observers) {
+    if (observer.node == node) {
+      // The boxes follow the new radius on the next update
+      observer.radius = radius;
+      return;
+    }
+  }
+  Observer observer;
+  observer.node = node;
+  observer.radius = radius;
+  observer.position = node->get_global_transform().origin;
+  _observers.push_back(observer);
+  // Stop observing the node before it can be freed
+  node->connect("tree_exiting", this, "remove_observer", Array::make(node));
+}
+
+void Terrain::remove_observer(Spatial *node) {
+  auto it = std::find_if(
+      _observers.begin(), _observers.end(),
+      [&](const Observer &observer) { return observer.node == node; });
+  if (it == _observers.end()) {
+    return;
+  }
+  for_each_in_difference(it->retain_box, ChunkBox(),
+                         [&](const ChunkCoord &cc) { release_chunk(cc); });
+  _observers.erase(it);
+
+  if (node->is_connected("tree_exiting", this, "remove_observer")) {
+    node->disconnect("tree_exiting", this, "remove_observer");
+  }
+  if (node == _player) {
+    _player = nullptr;
+  }
+}
+
+Terrain::ChunkBox Terrain::chunk_box(const ChunkCoord &center,
+                                     int64_t radius) const {
+  ChunkBox box;
+  box.min = ChunkCoord{center.x - radius, center.y - radius, center.z - radius};
+  box.max = ChunkCoord{center.x + radius, center.y + radius, center.z + radius};
+  return box;
+}
+
+template <typename F>
+void Terrain::for_each_in_difference(const ChunkBox &a, const ChunkBox &b,
+                                     F f) {
+  for (int64_t x = a.min.x; x <= a.max.x; ++x) {
+    bool x_inside = x >= b.min.x && x <= b.max.x;
+    for (int64_t y = a.min.y; y <= a.max.y; ++y) {
+      if (!x_inside || y < b.min.y || y > b.max.y) {
+        for (int64_t z = a.min.z; z <= a.max.z; ++z) {
+          f(ChunkCoord{x, y, z});
+        }
+        continue;
+      }
+      // Only the ends of the row stick out of b
+      for (int64_t z = a.min.z; z <= std::min(a.max.z, b.min.z - 1); ++z) {
+        f(ChunkCoord{x, y, z});
+      }
+      for (int64_t z = std::max(a.min.z, b.max.z + 1); z <= a.max.z; ++z) {
+        f(ChunkCoord{x, y, z});
+      }
+    }
+  }
+}
+
+bool Terrain::update_observer(Observer &observer, float delta) {
+  Vector3 position = observer.node->get_global_transform().origin;
+  ChunkCoord center{int64_t(position.x / _chunk_size),
+                    int64_t(position.y / _chunk_size),
+                    int64_t(position.z / _chunk_size)};
+
+  // The center of the volume of chunks to load
+  ChunkCoord load_center = center;
+  if (_prefetch) {
+    // Move the volume towards where the observer will be, but keep the
+    // observer well inside of it.
+    Vector3 velocity = get_observer_velocity(observer, position, delta);
+    Vector3 lookahead = velocity * _prefetch_time / _chunk_size;
+    auto offset = [&](double chunks) {
+      double max_offset = observer.radius / 2.0;
+      return int64_t(
+          std::round(std::max(-max_offset, std::min(chunks, max_offset))));
+    };
+    load_center.x += offset(lookahead.x);
+    load_center.y += offset(lookahead.y);
+    load_center.z += offset(lookahead.z);
+
+    // Prefer the direction of motion, fall back to the view direction when
+    // standing still.
+    Camera *camera = get_viewport()->get_camera();
+    if (velocity.length() > 1) {
+      observer.direction = velocity.normalized();
+    } else if (observer.node == _player && camera != nullptr) {
+      observer.direction = -camera->get_global_transform().basis.get_axis(2);
+    } else {
+      observer.direction =
+          -observer.node->get_global_transform().basis.get_axis(2);
+    }
+  }
+  observer.position = position;
+
+  ChunkBox retain_box = chunk_box(center, int64_t(1.5 * observer.radius));
+  ChunkBox load_box = chunk_box(load_center, observer.radius);
+  load_box.min.y = std::max(load_box.min.y, _floor);
+  load_box.max.y = std::min(load_box.max.y, _ceiling);
+
+  for_each_in_difference(retain_box, observer.retain_box,
+                         [&](const ChunkCoord &cc) { _chunk_refs[cc]++; });
+  for_each_in_difference(observer.retain_box, retain_box,
+                         [&](const ChunkCoord &cc) { release_chunk(cc); });
+
+  if (_chunks.count(center) == 0 && center.y >= _floor &&
+      center.y <= _ceiling) {
+    load_chunk_sequential(center.x, center.y, center.z);
+  }
+
+  // Chunks outside of every retain box would never be unloaded, so only load
+  // retained ones
+  bool enqueued = false;
+  for_each_in_difference(
+      load_box, observer.load_box, [&](const ChunkCoord &cc) {
+        if (_chunks.count(cc) == 0 && retain_box.contains(cc)) {
+          load_chunk(cc.x, cc.y, cc.z);
+          enqueued = true;
+        }
+      });
+
+  bool moved = !(load_box.min == observer.load_box.min &&
+                 load_box.max == observer.load_box.max);
+  observer.retain_box = retain_box;
+  observer.load_box = load_box;
+  return enqueued || moved;
+}
+
+void Terrain::activate_chunk(const ChunkCoord &cc, Chunk *chunk) {
+  _visibility_dirty = true;
+  chunk->set_batched(_batch_regions);
+  chunk->set_keep_mesh_data(_keep_mesh_data);
+  {
+    VOXEL_TRACE_SCOPE("update_tree", cc.x, cc.y, cc.z);
+    chunk->update_tree();
+  }
+  chunk->set_state(Chunk::State::ACTIVE);
+  _active_bytes += chunk->memory_usage();
+  if (_decorate) {
+    update_decorations(cc);
+    update_decorations(ChunkCoord{cc.x, cc.y - 1, cc.z});
+  }
+
+  if (_batch_regions && !chunk->empty) {
+    ChunkCoord rc = region_coord(cc);
+    Region *&region = _regions[rc];
+    if (region == nullptr) {
+      region = new Region();
+      region->position = Vector3(rc.x * _region_size * _chunk_size,
+                                 rc.y * _region_size * _chunk_size,
+                                 rc.z * _region_size * _chunk_size);
+    }
+    region->add_chunk(chunk);
+    _dirty_regions.push_back(rc);
+  }
+  if (_navigation) {
+    NavChunk nav = chunk->get_nav_chunk();
+    nav.bottom_air = chunk->get_bottom_air();
+    _nav_graph.add_chunk(cc.x, cc.y, cc.z, std::move(nav));
+  }
+}
+
+void Terrain::deactivate_chunk(const ChunkCoord &cc, Chunk *chunk) {
+  _visibility_dirty = true;
+  if (_batch_regions) {
+    ChunkCoord rc = region_coord(cc);
+    auto it = _regions.find(rc);
+    if (it != _regions.end()) {
+      it->second->remove_chunk(chunk);
+      _dirty_regions.push_back(rc);
+    }
+  }
+  if (_navigation) {
+    _nav_graph.remove_chunk(cc.x, cc.y, cc.z);
+  }
+  // Queued chunks were never counted by activate_chunk
+  if (chunk->get_state() == Chunk::State::ACTIVE) {
+    _active_bytes -= chunk->memory_usage();
+  }
+  chunk->unload();
+  if (_decorate) {
+    // The chunk below loses the air that confirmed its top layer
+    update_decorations(ChunkCoord{cc.x, cc.y - 1, cc.z});
+  }
+}
+
+void Terrain::update_decorations(const ChunkCoord &cc) {
+  auto it = _chunks.find(cc);
+  if (it == _chunks.end() ||
+      it->second->get_state() != Chunk::State::ACTIVE) {
+    return;
+  }
+  const std::vector<uint8_t> *above_air = nullptr;
+  if (cc.y >= _ceiling) {
+    above_air = &_open_air;
+  } else {
+    auto above = _chunks.find(ChunkCoord{cc.x, cc.y + 1, cc.z});
+    if (above != _chunks.end() &&
+        above->second->get_state() == Chunk::State::ACTIVE) {
+      above_air = &above->second->get_bottom_air();
+    }
+  }
+  it->second->update_decorations(above_air);
+}
+
+Terrain::ChunkCoord Terrain::region_coord(const ChunkCoord &cc) const {
+  // round towards negative infinity, so regions don't straddle the origin
+  return ChunkCoord{floor_div(cc.x, _region_size),
+                    floor_div(cc.y, _region_size),
+                    floor_div(cc.z, _region_size)};
+}
+
+void Terrain::rebuild_regions() {
+  int64_t rebuilt = 0;
+  while (rebuilt < _region_rebuilds_per_frame && !_dirty_regions.empty()) {
+    ChunkCoord rc = _dirty_regions.back();
+    _dirty_regions.pop_back();
+
+    auto it = _regions.find(rc);
+    if (it == _regions.end() || !it->second->dirty) {
+      // Already rebuilt through an earlier entry
+      continue;
+    }
+    Region *region = it->second;
+    if (region->empty()) {
+      delete region;
+      _regions.erase(it);
+      continue;
+    }
+    region->rebuild(_material, get_world()->get_scenario());
+    rebuilt++;
+  }
+}
+
+void Terrain::start_trace() {
+#ifdef VOXEL_TRACE
+  TraceRecorder::instance().start();
+#else
+  Godot::print("Tracing is disabled, build with VOXEL_TRACE to enable it");
+#endif
+}
+
+void Terrain::stop_trace() {
+#ifdef VOXEL_TRACE
+  TraceRecorder::instance().stop();
+#endif
+}
+
+bool Terrain::dump_trace(String path) {
+#ifdef VOXEL_TRACE
+  String global_path = ProjectSettings::get_singleton()->globalize_path(path);
+  if (!TraceRecorder::instance().write_json(global_path.utf8().get_data())) {
+    Godot::print("Unable to write the trace to " + global_path);
+    return false;
+  }
+  return true;
+#else
+  Godot::print("Tracing is disabled, build with VOXEL_TRACE to enable it");
+  return false;
+#endif
+}
+
+Dictionary Terrain::raycast(Vector3 from, Vector3 direction,
+                            double max_distance) {
+  std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+  Dictionary result;
+  RayHit hit;
+  if (cast_ray(from, direction, max_distance, &hit)) {
+    result["position"] = hit.position;
+    result["normal"] = hit.normal;
+    result["distance"] = hit.distance;
+    result["voxel"] = hit.voxel;
+    result["block"] = hit.block;
+  }
+  return result;
+}
+
+PoolRealArray Terrain::raycast_batch(PoolVector3Array from,
+                                     PoolVector3Array directions,
+                                     double max_distance) {
+  int count = std::min(from.size(), directions.size());
+  PoolRealArray distances;
+  distances.resize(count);
+  {
+    PoolVector3Array::Read f = from.read();
+    PoolVector3Array::Read d = directions.read();
+    PoolRealArray::Write w = distances.write();
+    std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+    for (int i = 0; i < count; ++i) {
+      RayHit hit;
+      w[i] = cast_ray(f[i], d[i], max_distance, &hit) ? hit.distance : -1;
+    }
+  }
+  return distances;
+}
+
+int64_t Terrain::get_block_at(Vector3 point) {
+  double voxel_size = _chunk_size / _chunk_num_blocks;
+  double half_size = _chunk_size / 2;
+  std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+  VoxelLookup lookup;
+  return voxel_at(int64_t(std::floor((point.x + half_size) / voxel_size)),
+                  int64_t(std::floor((point.y + half_size) / voxel_size)),
+                  int64_t(std::floor((point.z + half_size) / voxel_size)),
+                  lookup);
+}
+
+bool Terrain::is_solid(Vector3 point) {
+  return get_block_at(point) > int64_t(Block::AIR);
+}
+
+PoolByteArray Terrain::is_solid_batch(PoolVector3Array points) {
+  double voxel_size = _chunk_size / _chunk_num_blocks;
+  double half_size = _chunk_size / 2;
+  PoolByteArray solid;
+  solid.resize(points.size());
+  {
+    PoolVector3Array::Read p = points.read();
+    PoolByteArray::Write w = solid.write();
+    std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+    VoxelLookup lookup;
+    for (int i = 0; i < points.size(); ++i) {
+      int64_t block =
+          voxel_at(int64_t(std::floor((p[i].x + half_size) / voxel_size)),
+                   int64_t(std::floor((p[i].y + half_size) / voxel_size)),
+                   int64_t(std::floor((p[i].z + half_size) / voxel_size)),
+                   lookup);
+      w[i] = block > int64_t(Block::AIR);
+    }
+  }
+  return solid;
+}
+
+bool Terrain::is_box_occupied(AABB box) {
+  double voxel_size = _chunk_size / _chunk_num_blocks;
+  double half_size = _chunk_size / 2;
+  Vector3 end = box.get_end();
+  auto first = [&](double v) {
+    return int64_t(std::floor((v + half_size) / voxel_size));
+  };
+  // Voxels only touching the box don't overlap it
+  auto last = [&](double v) {
+    return int64_t(std::ceil((v + half_size) / voxel_size)) - 1;
+  };
+
+  std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+  VoxelLookup lookup;
+  for (int64_t y = first(box.position.y); y <= last(end.y); ++y) {
+    for (int64_t z = first(box.position.z); z <= last(end.z); ++z) {
+      for (int64_t x = first(box.position.x); x <= last(end.x); ++x) {
+        if (voxel_at(x, y, z, lookup) > int64_t(Block::AIR)) {
+          return true;
+        }
+      }
+    }
+  }
+  return false;
+}
+
+double Terrain::get_surface_height(double x, double z) {
+  std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+  VoxelLookup lookup;
+  return surface_height(x, z, lookup);
+}
+
+PoolRealArray Terrain::get_surface_height_batch(PoolVector2Array points) {
+  PoolRealArray heights;
+  heights.resize(points.size());
+  {
+    PoolVector2Array::Read p = points.read();
+    PoolRealArray::Write w = heights.write();
+    std::shared_lock<std::shared_mutex> lock(_chunks_lock);
+    VoxelLookup lookup;
+    for (int i = 0; i < points.size(); ++i) {
+      w[i] = surface_height(p[i].x, p[i].y, lookup);
+    }
+  }
+  return heights;
+}
+
+PoolVector3Array Terrain::find_path(Vector3 from, Vector3 to) {
+  // Bounds the search when the target isn't reachable
+  constexpr size_t MAX_VISITED = 1 << 16;
+
+  PoolVector3Array points;
+  double voxel_size = _chunk_size / _chunk_num_blocks;
+  double half_size = _chunk_size / 2;
+  auto voxel = [&](double v) {
+    return int64_t(std::floor((v + half_size) / voxel_size));
+  };
+  // The agent may stand up to a drop above the ground
+  int64_t depth = _nav_clearance + _nav_max_drop;
+  NavCoord start, goal;
+  if (!_nav_graph.find_node(voxel(from.x), voxel(from.y), voxel(from.z), depth,
+                            &start) ||
+      !_nav_graph.find_node(voxel(to.x), voxel(to.y), voxel(to.z), depth,
+                            &goal)) {
+    return points;
+  }
+
+  std::vector<NavCoord> path;
+  if (!_nav_graph.find_path(start, goal, &path, MAX_VISITED)) {
+    return points;
+  }
+  points.resize(path.size());
+  PoolVector3Array::Write w = points.write();
+  for (size_t i = 0; i < path.size(); ++i) {
+    // The center of the top of the node
+    w[i] = Vector3((path[i].x + 0.5) * voxel_size - half_size,
+                   (path[i].y + 1) * voxel_size - half_size,
+                   (path[i].z + 0.5) * voxel_size - half_size);
+  }
+  return points;
+}
+
+int64_t Terrain::voxel_at(int64_t x, int64_t y, int64_t z,
+                          VoxelLookup &lookup) const {
+  int64_t n = _chunk_num_blocks;
+  ChunkCoord cc{floor_div(x, n), floor_div(y, n), floor_div(z, n)};
+  if (!lookup.valid || !(lookup.cc == cc)) {
+    lookup.cc = cc;
+    lookup.valid = true;
+    lookup.chunk = nullptr;
+    auto it = _chunks.find(cc);
+    // Chunks that are still building have no complete voxels yet
+    if (it != _chunks.end() &&
+        it->second->get_state() == Chunk::State::ACTIVE) {
+      lookup.chunk = it->second;
+    }
+  }
+  if (lookup.chunk == nullptr) {
+    return -1;
+  }
+  return int64_t(lookup.chunk->get_block(x - cc.x * n, y - cc.y * n,
+                                         z - cc.z * n));
+}
+
+bool Terrain::cast_ray(const Vector3 &from, const Vector3 &direction,
+                       double max_distance, RayHit *hit) const {
+  double length = direction.length();
+  if (length == 0) {
+    return false;
+  }
+  double voxel_size = _chunk_size / _chunk_num_blocks;
+  double half_size = _chunk_size / 2;
+
+  // Walk in voxel units, where voxel v covers [v, v + 1) on each axis
+  double origin[3] = {(from.x + half_size) / voxel_size,
+                      (from.y + half_size) / voxel_size,
+                      (from.z + half_size) / voxel_size};
+  double dir[3] = {direction.x / length, direction.y / length,
+                   direction.z / length};
+  int64_t voxel[3];
+  int64_t step[3];
+  // The ray parameter at the next voxel boundary on each axis, and between
+  // two boundaries
+  double t_max[3];
+  double t_delta[3];
+  for (int a = 0; a < 3; ++a) {
+    voxel[a] = int64_t(std::floor(origin[a]));
+    if (dir[a] > 0) {
+      step[a] = 1;
+      t_max[a] = (voxel[a] + 1 - origin[a]) / dir[a];
+      t_delta[a] = 1 / dir[a];
+    } else if (dir[a] < 0) {
+      step[a] = -1;
+      t_max[a] = (voxel[a] - origin[a]) / dir[a];
+      t_delta[a] = -1 / dir[a];
+    } else {
+      step[a] = 0;
+      t_max[a] = std::numeric_limits<double>::infinity();
+      t_delta[a] = std::numeric_limits<double>::infinity();
+    }
+  }
+
+  double t_end = max_distance / voxel_size;
+  double t = 0;
+  // The axis of the last step, -1 while in the start voxel
+  int axis = -1;
+  VoxelLookup lookup;
+  while (t <= t_end) {
+    int64_t block = voxel_at(voxel[0], voxel[1], voxel[2], lookup);
+    if (block > int64_t(Block::AIR)) {
+      Vector3 normal;
+      if (axis >= 0) {
+        normal[axis] = -step[axis];
+      }
+      hit->distance = t * voxel_size;
+      hit->position = from + direction / length * hit->distance;
+      hit->normal = normal;
+      hit->voxel = Vector3(voxel[0], voxel[1], voxel[2]);
+      hit->block = block;
+      return true;
+    }
+    if (t_max[0] < t_max[1]) {
+      axis = t_max[0] < t_max[2] ? 0 : 2;
+    } else {
+      axis = t_max[1] < t_max[2] ? 1 : 2;
+    }
+    t = t_max[axis];
+    voxel[axis] += step[axis];
+    t_max[axis] += t_delta[axis];
+  }
+  return false;
+}
+
+double Terrain::surface_height(double x, double z, VoxelLookup &lookup) const {
+  int64_t n = _chunk_num_blocks;
+  double voxel_size = _chunk_size / _chunk_num_blocks;
+  double half_size = _chunk_size / 2;
+  int64_t vx = int64_t(std::floor((x + half_size) / voxel_size));
+  int64_t vz = int64_t(std::floor((z + half_size) / voxel_size));
+
+  int64_t vy = (_ceiling + 1) * n - 1;
+  while (vy >= _floor * n) {
+    int64_t block = voxel_at(vx, vy, vz, lookup);
+    if (block > int64_t(Block::AIR)) {
+      return (vy + 1) * voxel_size - half_size;
+    }
+    if (block < 0) {
+      // Skip the rest of the chunk that isn't loaded
+      vy = floor_div(vy, n) * n - 1;
+    } else {
+      vy--;
+    }
+  }
+  return NAN;
+}
+
+Vector3 Terrain::get_view_position() {
+  Camera *camera = get_viewport()->get_camera();
+  if (camera != nullptr) {
+    return camera->get_global_transform().origin;
+  }
+  if (_player != nullptr) {
+    return _player->get_global_transform().origin;
+  }
+  return get_global_transform().origin;
+}
+
+Vector3 Terrain::get_observer_velocity(const Observer &observer,
+                                       const Vector3 &position, float delta) {
+  Vector3 velocity;
+  Variant v = observer.node->get("velocity");
+  if (v.get_type() == Variant::VECTOR3) {
+    velocity = v;
+  } else if (delta > 0) {
+    velocity = (position - observer.position) / delta;
+  }
+  return velocity;
+}
+
+void Terrain::prioritize_chunks_to_load() {
+  // Lower scores are built first, each chunk is scored for the observer it
+  // matters most to
+  auto score = [&](const Chunk *c) {
+    double best = std::numeric_limits<double>::max();
+    for (const Observer &observer : _observers) {
+      Vector3 to_chunk = c->position - observer.position;
+      double distance = to_chunk.length();
+      if (distance == 0) {
+        return 0.0;
+      }
+      best = std::min(best, distance - _prefetch_bias * _chunk_size *
+                                           to_chunk.dot(observer.direction) /
+                                           distance);
+    }
+    return best;
+  };
+
+  _jobs_mutex.lock();
+  std::vector<std::pair<double, Chunk *>> scored;
+  scored.reserve(_chunks_to_load.size());
+  for (Chunk *c : _chunks_to_load) {
+    scored.push_back(std::make_pair(score(c), c));
+  }
+  // Workers take chunks from the back, so sort by descending score
+  std::sort(scored.begin(), scored.end(),
+            [](const std::pair<double, Chunk *> &a,
+               const std::pair<double, Chunk *> &b) {
+              return a.first > b.first;
+            });
+  for (size_t i = 0; i < scored.size(); ++i) {
+    _chunks_to_load[i] = scored[i].second;
+  }
+  _jobs_mutex.unlock();
+}
+
+void Terrain::update_occlusion() {
+  Vector3 view_pos = get_view_position();
+  ChunkCoord view_cc{int64_t(std::floor(view_pos.x / _chunk_size + 0.5)),
+                     int64_t(std::floor(view_pos.y / _chunk_size + 0.5)),
+                     int64_t(std::floor(view_pos.z / _chunk_size + 0.5))};
+  if (!_visibility_dirty && view_cc == _view_chunk) {
+    return;
+  }
+  _visibility_dirty = false;
+  _view_chunk = view_cc;
+
+  // The offsets to the neighbour behind each face of a chunk
+  static const ChunkCoord FACE_OFFSETS[Chunk::FACE_COUNT] = {
+      {1, 0, 0}, {-1, 0, 0}, {0, 1, 0}, {0, -1, 0}, {0, 0, 1}, {0, 0, -1}};
+  auto opposite = [](int face) { return face ^ 1; };
+
+  struct Step {
+    ChunkCoord cc;
+    // The face the chunk was entered through, -1 for the view chunk
+    int entered;
+    // The faces the walk has left chunks through so far
+    uint8_t directions;
+  };
+
+  std::unordered_set<ChunkCoord, ChunkCoordHash> visible;
+  std::vector<Step> queue;
+  // Only walk the volume that can contain loaded chunks, with one layer of
+  // air above and below the world.
+  int64_t range = 1.5 * _loaded_radius + 1;
+  bool view_inside = view_cc.y >= _floor - 1 && view_cc.y <= _ceiling + 1;
+  if (view_inside) {
+    queue.push_back(Step{view_cc, -1, 0});
+    visible.insert(view_cc);
+  }
+
+  for (size_t head = 0; head < queue.size(); ++head) {
+    Step step = queue[head];
+    auto it = _chunks.find(step.cc);
+    Chunk *chunk = nullptr;
+    if (it != _chunks.end() &&
+        it->second->get_state() == Chunk::State::ACTIVE) {
+      chunk = it->second;
+    }
+    for (int face = 0; face < Chunk::FACE_COUNT; ++face) {
+      // Never walk back towards the view
+      if (step.directions & (1 << opposite(face))) {
+        continue;
+      }
+      // Chunks that are not loaded yet are treated as air
+      if (chunk != nullptr && step.entered >= 0 &&
+          !chunk->faces_connected(Chunk::Face(step.entered),
+                                  Chunk::Face(face))) {
+        continue;
+      }
+      ChunkCoord next{step.cc.x + FACE_OFFSETS[face].x,
+                      step.cc.y + FACE_OFFSETS[face].y,
+                      step.cc.z + FACE_OFFSETS[face].z};
+      if (std::abs(next.x - view_cc.x) > range ||
+          std::abs(next.z - view_cc.z) > range || next.y < _floor - 1 ||
+          next.y > _ceiling + 1 || visible.count(next) > 0) {
+        continue;
+      }
+      visible.insert(next);
+      queue.push_back(
+          Step{next, opposite(face), uint8_t(step.directions | (1 << face))});
+    }
+  }
 
-  // The chunk can now be reused
+  std::unordered_set<ChunkCoord, ChunkCoordHash> visible_regions;
+  for (const std::pair<const ChunkCoord, Chunk *> &p : _chunks) {
+    bool is_visible = !view_inside || visible.count(p.first) > 0;
+    p.second->set_visible(is_visible);
+    if (is_visible && _batch_regions) {
+      visible_regions.insert(region_coord(p.first));
+    }
+  }
+  for (std::pair<const ChunkCoord, Region *> &p : _regions) {
+    p.second->set_visible(!view_inside || visible_regions.count(p.first) > 0);
+  }
+}
 
+size_t Terrain::resident_bytes() {
+  size_t inactive = 0;
+  {
+    // The workers don't touch queued chunks while the lock is held. Chunks a
+    // job is running on are only counted by their size.
+    std::lock_guard<std::mutex> lock(_jobs_mutex);
+    std::unordered_set<Chunk *> meshing;
+    for (const Job &job : _chunks_to_mesh) {
+      meshing.insert(job.chunk);
+    }
+    for (const std::pair<const ChunkCoord, Chunk *> &p : _chunks) {
+      Chunk *chunk = p.second;
+      Chunk::State state = chunk->get_state();
+      if (state == Chunk::State::ACTIVE) {
+        continue;
+      }
+      if (state == Chunk::State::BUILDING && meshing.count(chunk) == 0) {
+        inactive += sizeof(Chunk);
+      } else {
+        inactive += chunk->memory_usage();
+      }
+    }
+  }
   _chunk_pool_mutex->lock();
-  _chunk_pool.push_back(it->second);
+  for (Chunk *chunk : _chunk_pool) {
+    inactive += chunk->memory_usage();
+  }
   _chunk_pool_mutex->unlock();
+  return _active_bytes + inactive + _mesh_cache.memory_usage();
+}
+
+void Terrain::trim_chunk_pool() {
+  size_t budget = _memory_budget_mb * 1024 * 1024;
+  size_t resident = budget > 0 ? resident_bytes() : 0;
+
+  std::vector<Chunk *> to_delete;
+  _chunk_pool_mutex->lock();
+  while (!_chunk_pool.empty() &&
+         (int64_t(_chunk_pool.size()) > _max_pooled_chunks ||
+          (budget > 0 && resident > budget))) {
+    Chunk *chunk = _chunk_pool.back();
+    _chunk_pool.pop_back();
+    resident -= std::min(resident, chunk->memory_usage());
+    to_delete.push_back(chunk);
+  }
+  _chunk_pool_mutex->unlock();
+
+  for (Chunk *c : to_delete) {
+    delete c;
+  }
+  if (budget > 0 && resident > budget && !_budget_warning_shown) {
+    Godot::print_warning(
+        "The active terrain chunks exceed the memory budget, reduce the load "
+        "distance or raise the budget.",
+        __FUNCTION__, __FILE__, __LINE__);
+    _budget_warning_shown = true;
+  }
+}
+
+Dictionary Terrain::get_memory_usage() {
+  Dictionary usage;
+  size_t resident = resident_bytes();
+  int64_t num_chunks = _chunks.size();
+  _chunk_pool_mutex->lock();
+  int64_t num_pooled = _chunk_pool.size();
+  _chunk_pool_mutex->unlock();
+
+  usage["resident_bytes"] = int64_t(resident);
+  usage["active_bytes"] = int64_t(_active_bytes);
+  usage["loaded_chunks"] = num_chunks;
+  usage["pooled_chunks"] = num_pooled;
+  usage["bytes_per_chunk"] =
+      num_chunks + num_pooled > 0
+          ? int64_t(resident / (num_chunks + num_pooled))
+          : int64_t(0);
+  usage["budget_bytes"] = int64_t(_memory_budget_mb * 1024 * 1024);
+  usage["shared_meshes"] = int64_t(_mesh_cache.mesh_count());
+  usage["shared_shapes"] = int64_t(_mesh_cache.shape_count());
+  usage["mesh_cache_hits"] = _mesh_cache.hits();
+  usage["baked_bytes"] =
+      _baked_world ? int64_t(_baked_world->memory_usage()) : int64_t(0);
+  return usage;
+}
+
+void Terrain::load_baked_world() {
+  String path = ProjectSettings::get_singleton()->globalize_path(
+      _baked_world_path);
+  std::unique_ptr<BakedWorld> baked(new BakedWorld());
+  if (!baked->open(path.utf8().get_data())) {
+    Godot::print("Unable to open the baked world " + path);
+    return;
+  }
+  const BakedWorld::Settings &settings = baked->settings();
+  if (settings.divisions != _chunk_num_blocks ||
+      settings.chunk_size != _chunk_size) {
+    Godot::print("The baked world " + path +
+                 " has different chunk dimensions, generating instead");
+    return;
+  }
+  // create_generator would fall back to the noise generator, which doesn't
+  // match the baked chunks
+  if (settings.generator < 0 ||
+      settings.generator >= int32_t(FbmPreset::COUNT)) {
+    Godot::print("The baked world " + path +
+                 " uses an unknown generator, generating instead");
+    return;
+  }
+  _seed = settings.seed;
+  _random_seed = false;
+  _generator_type = GENERATOR_HILLS + settings.generator;
+  _density = settings.density;
+  Godot::print("Loaded " + String::num_int64(baked->size()) +
+               " baked chunks from " + path);
+  _baked_world = std::move(baked);
+}
+
+void Terrain::create_generator() {
+  switch (_generator_type) {
+    case GENERATOR_ISLAND:
+      _generator.reset(
+          new IslandGenerator(_island_size, 1, _island_height, _seed));
+      break;
+    case GENERATOR_HILLS:
+      _generator = create_fbm_generator(FbmPreset::HILLS, _seed);
+      break;
+    case GENERATOR_MOUNTAINS:
+      _generator = create_fbm_generator(FbmPreset::MOUNTAINS, _seed);
+      break;
+    case GENERATOR_CANYONS:
+      _generator = create_fbm_generator(FbmPreset::WARPED_CANYONS, _seed);
+      break;
+    default:
+      _generator.reset(new NoiseGenerator(_noise));
+      break;
+  }
 }
 
 Chunk *Terrain::acquire_chunk() {
@@ -265,18 +1610,32 @@ Chunk *Terrain::acquire_chunk() {
   if (_chunk_pool.size() > 0) {
     chunk = _chunk_pool.back();
     _chunk_pool.pop_back();
+    VOXEL_TRACE_INSTANT("pool_reuse", 0, 0, 0);
   }
   _chunk_pool_mutex->unlock();
   if (chunk == nullptr) {
+    VOXEL_TRACE_INSTANT("pool_new", 0, 0, 0);
     RID space_rid = get_world()->get_space();
     RID scenario_rid = get_world()->get_scenario();
     chunk = new Chunk();
     chunk->set_size(_chunk_num_blocks);
     chunk->set_world_size(_chunk_size);
-    chunk->set_noise(_noise);
+    chunk->set_generator(_generator.get());
+    chunk->set_density(_density);
+    chunk->set_baked_world(_baked_world.get());
+    chunk->set_material(_material);
     chunk->set_space_rid(space_rid);
     chunk->set_scenario_rid(scenario_rid);
+    Ref<Mesh> meshes[DECORATION_COUNT] = {_grass_mesh, _rock_mesh,
+                                          _tree_mesh};
+    for (size_t i = 0; i < DECORATION_COUNT; ++i) {
+      if (meshes[i].is_valid()) {
+        chunk->set_decoration_mesh(Decoration(i), meshes[i]->get_rid());
+      }
+    }
   }
+  // Pooled chunks hold no RIDs, so the cache may change here
+  chunk->set_mesh_cache(_share_meshes ? &_mesh_cache : nullptr);
   return chunk;
 }
 
@@ -3,16 +3,31 @@
 
 #include <Godot.hpp>
 #include <Material.hpp>
+#include <Mesh.hpp>
 #include <MeshInstance.hpp>
+#include <OpenSimplexNoise.hpp>
+#include <ShaderMaterial.hpp>
 #include <StaticBody.hpp>
+#include <TextureArray.hpp>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <shared_mutex>
 #include <unordered_map>
+#include <unordered_set>
 
-#include <Semaphore.hpp>
 #include <Mutex.hpp>
 #include <Thread.hpp>
 
+#include "BakedWorld.h"
 #include "Chunk.h"
+#include "MeshCache.h"
+#include "NavGraph.h"
+#include "Region.h"
+#include "TerrainGenerator.h"
 
+#include <memory>
 #include <vector>
 
 namespace godot {
@@ -20,6 +35,14 @@ namespace godot {
 class Terrain : public Spatial {
   GODOT_CLASS(Terrain, Spatial)
 
+  enum GeneratorType {
+    GENERATOR_NOISE = 0,
+    GENERATOR_ISLAND,
+    GENERATOR_HILLS,
+    GENERATOR_MOUNTAINS,
+    GENERATOR_CANYONS
+  };
+
   struct ChunkCoord {
     int64_t x, y, z;
 
@@ -29,7 +52,73 @@ class Terrain : public Spatial {
   };
 
   struct ChunkCoordHash {
-    size_t operator()(const ChunkCoord &c) const { return c.x ^ c.y ^ c.z; }
+    // Nearby coordinates cancel out under a plain xor, which put whole load
+    // volumes into a handful of buckets
+    size_t operator()(const ChunkCoord &c) const {
+      return size_t(c.x * 73856093) ^ size_t(c.y * 19349663) ^
+             size_t(c.z * 83492791);
+    }
+  };
+
+  /**
+   * @brief An axis aligned box of chunk coordinates, min and max are
+   * inclusive. Boxes with a min greater than their max are empty.
+   */
+  struct ChunkBox {
+    ChunkCoord min{0, 0, 0};
+    ChunkCoord max{-1, -1, -1};
+
+    bool contains(const ChunkCoord &c) const {
+      return c.x >= min.x && c.x <= max.x && c.y >= min.y && c.y <= max.y &&
+             c.z >= min.z && c.z <= max.z;
+    }
+  };
+
+  /**
+   * @brief A node the terrain is loaded around. Chunks within radius of the
+   * observer are loaded and chunks within 1.5 times the radius are kept.
+   */
+  struct Observer {
+    Spatial *node;
+    int64_t radius;
+    ChunkBox load_box;
+    ChunkBox retain_box;
+    /**
+     * @brief Where the observer was and was heading at its last update, used
+     * to order the build queue.
+     */
+    Vector3 position;
+    Vector3 direction;
+  };
+
+  /**
+   * @brief The stages the workers build a chunk in. The heights of a column
+   * are sampled once for all chunks of the column, the voxels of a chunk wait
+   * for them, and the mesh and collision faces wait for the voxels. The main
+   * thread integrates the finished chunks in _process.
+   */
+  enum Stage { STAGE_HEIGHTS = 0, STAGE_VOXELS, STAGE_MESH, STAGE_COUNT };
+
+  /**
+   * @brief The heights shared by the chunks above each other.
+   */
+  struct Column {
+    enum class State { WAITING, SAMPLING, READY };
+    ChunkCoord cc{0, 0, 0};
+    State state = State::WAITING;
+    std::vector<double> heights;
+    /**
+     * @brief The queued chunks of the column and the job sampling it. The
+     * column is dropped once none is left.
+     */
+    int64_t references = 0;
+  };
+
+  struct Job {
+    Stage stage = STAGE_VOXELS;
+    Chunk *chunk = nullptr;
+    Column *column = nullptr;
+    uint64_t generation = 0;
   };
 
  public:
@@ -41,17 +130,290 @@ class Terrain : public Spatial {
   void _init();
   void _ready();
   void _process(float delta);
+  void _exit_tree();
+
+  /**
+   * @brief Returns performance counters of the chunk pipeline. The chunk
+   * latencies are cleared by every call.
+   */
+  Dictionary get_statistics();
+
+  /**
+   * @brief Returns the memory used by loaded and pooled chunks, and by the
+   * baked world.
+   */
+  Dictionary get_memory_usage();
+
+  /**
+   * @brief Loads the terrain within radius chunks around the node as well,
+   * until remove_observer is called or the node leaves the tree. Chunks seen by
+   * several observers are only loaded once. A radius of 0 or less uses the
+   * load distance.
+   */
+  void add_observer(Spatial *node, int64_t radius);
+
+  void remove_observer(Spatial *node);
+
+  /**
+   * @brief Records a timeline of the chunk pipeline until stop_trace is
+   * called. Only available in builds with VOXEL_TRACE defined.
+   */
+  void start_trace();
+  void stop_trace();
+
+  /**
+   * @brief Writes the recorded timeline as Chrome trace event JSON, which
+   * chrome://tracing and ui.perfetto.dev open.
+   */
+  bool dump_trace(String path);
+
+  /**
+   * @brief Casts a ray through the voxels of the loaded chunks. Returns the
+   * position, normal, distance, voxel and block of the first solid voxel within
+   * max_distance, or an empty dictionary. Voxels are counted from the corner
+   * of chunk (0, 0, 0). Chunks that are not loaded count as air. The voxel
+   * queries read the voxel data directly, without the physics server, and may
+   * be called from any thread.
+   */
+  Dictionary raycast(Vector3 from, Vector3 direction, double max_distance);
+
+  /**
+   * @brief Casts a ray for every pair of origin and direction. Returns the
+   * distance to the first hit of each ray, or -1 if it hit nothing.
+   */
+  PoolRealArray raycast_batch(PoolVector3Array from,
+                              PoolVector3Array directions,
+                              double max_distance);
+
+  /**
+   * @brief Returns the Block at the point, or -1 if its chunk isn't loaded.
+   */
+  int64_t get_block_at(Vector3 point);
+
+  bool is_solid(Vector3 point);
+
+  /**
+   * @brief Returns 1 for every point inside a solid voxel, 0 otherwise.
+   */
+  PoolByteArray is_solid_batch(PoolVector3Array points);
+
+  /**
+   * @brief Returns true if any voxel overlapping the box is solid.
+   */
+  bool is_box_occupied(AABB box);
+
+  /**
+   * @brief Returns the height of the top of the highest solid voxel in the
+   * loaded chunks at x, z, or NAN if the column has no solid voxel.
+   */
+  double get_surface_height(double x, double z);
+
+  /**
+   * @brief get_surface_height for the x and y of every point.
+   */
+  PoolRealArray get_surface_height_batch(PoolVector2Array points);
+
+  /**
+   * @brief Returns the points an agent walks through from the ground below
+   * from to the ground below to, or an empty array if the loaded chunks
+   * don't connect them. Requires navigation to be enabled, and unlike the
+   * voxel queries only the main thread may call it.
+   */
+  PoolVector3Array find_path(Vector3 from, Vector3 to);
 
  private:
 
   std::unordered_map<ChunkCoord, Chunk *, ChunkCoordHash> _chunks;
+  /**
+   * @brief Only the main thread modifies _chunks, it holds the lock
+   * exclusively while doing so. The voxel queries hold it shared.
+   */
+  mutable std::shared_mutex _chunks_lock;
+
+  /**
+   * @brief Caches the chunk of the last voxel looked up, consecutive lookups
+   * mostly fall into the same chunk.
+   */
+  struct VoxelLookup {
+    ChunkCoord cc{0, 0, 0};
+    Chunk *chunk = nullptr;
+    bool valid = false;
+  };
+
+  struct RayHit {
+    double distance;
+    Vector3 position;
+    Vector3 normal;
+    Vector3 voxel;
+    int64_t block;
+  };
+
+  /**
+   * @brief Returns the block at the voxel coordinates, counted from the
+   * corner of chunk (0, 0, 0), or -1 if its chunk isn't active. The caller
+   * must hold _chunks_lock.
+   */
+  int64_t voxel_at(int64_t x, int64_t y, int64_t z, VoxelLookup &lookup) const;
+
+  /**
+   * @brief Walks the voxels along the ray (Amanatides and Woo) until it
+   * reaches a solid one. The caller must hold _chunks_lock.
+   */
+  bool cast_ray(const Vector3 &from, const Vector3 &direction,
+                double max_distance, RayHit *hit) const;
+
+  /**
+   * @brief The caller must hold _chunks_lock.
+   */
+  double surface_height(double x, double z, VoxelLookup &lookup) const;
 
   void unload_chunk(int64_t x, int64_t y, int64_t z);
 
+  /**
+   * @brief Drops one observer's reference to the chunk and unloads it once no
+   * observer retains it.
+   */
+  void release_chunk(const ChunkCoord &cc);
+
   void load_chunk(int64_t x, int64_t y, int64_t z);
   void load_chunk_sequential(int64_t x, int64_t y, int64_t z);
 
-  void process_chunks();
+  /**
+   * @brief The loop of worker index. Parks while index isn't below
+   * _active_workers, otherwise runs the jobs next_job hands out.
+   */
+  void process_chunks(int64_t index);
+
+  /**
+   * @brief Takes the next job whose dependencies are met and whose stage is
+   * below its concurrency limit. Mesh jobs go first, so voxels don't pile up
+   * waiting for their mesh. The caller must hold _jobs_mutex.
+   */
+  bool next_job(Job *job);
+
+  /**
+   * @brief Runs the job on the calling worker without holding _jobs_mutex.
+   * Returns false if the chunk was cancelled.
+   */
+  bool run_job(const Job &job);
+
+  /**
+   * @brief Queues the stage after the job's, or returns a cancelled chunk to
+   * the pool. The caller must hold _jobs_mutex.
+   */
+  void finish_job(const Job &job, bool done);
+
+  /**
+   * @brief True if another job of the stage may start. The caller must hold
+   * _jobs_mutex.
+   */
+  bool can_start(Stage stage) const;
+
+  /**
+   * @brief Drops the chunk's reference to its column's heights. The caller
+   * must hold _jobs_mutex.
+   */
+  void release_column(Chunk *chunk);
+  void release_column(Column *column);
+
+  /**
+   * @brief Adds or parks a worker depending on the queue depth and the frame
+   * time of the main thread.
+   */
+  void update_worker_count();
+
+  /**
+   * @brief Emits load_progress when chunks of the startup volume became
+   * active, and terrain_ready once all of them are.
+   */
+  void update_startup_progress();
+
+  /**
+   * @brief Moves the queued chunks of the startup volume to the end of the
+   * queue, where the workers pick them up first.
+   */
+  void prioritize_startup_chunks();
+
+  /**
+   * @brief Wakes all workers and waits for them to exit.
+   */
+  void stop_workers();
+
+  /**
+   * @brief Adds a freshly built chunk to the scene, either directly or through
+   * its region.
+   */
+  void activate_chunk(const ChunkCoord &cc, Chunk *chunk);
+
+  /**
+   * @brief Removes a chunk from the scene and releases its data. Chunks
+   * unloaded before they became active are not counted in _active_bytes.
+   */
+  void deactivate_chunk(const ChunkCoord &cc, Chunk *chunk);
+
+  /**
+   * @brief Redraws the decorations of the chunk if it is active, confirming
+   * its pending placements against the chunk above. Called whenever that
+   * chunk becomes active or is unloaded.
+   */
+  void update_decorations(const ChunkCoord &cc);
+
+  /**
+   * @brief Returns the coordinate of the region containing the chunk.
+   */
+  ChunkCoord region_coord(const ChunkCoord &cc) const;
+
+  /**
+   * @brief Rebuilds up to _region_rebuilds_per_frame dirty regions.
+   */
+  void rebuild_regions();
+
+  /**
+   * @brief Hides chunks that can't be seen from the camera. Walks the loaded
+   * chunks breadth first starting at the camera chunk, only moving away from
+   * the camera and only passing through chunks whose entry and exit faces are
+   * connected by air.
+   */
+  void update_occlusion();
+
+  /**
+   * @brief Returns the position occlusion culling is computed for, the
+   * current camera or the player if there is no camera.
+   */
+  Vector3 get_view_position();
+
+  /**
+   * @brief Returns the velocity of the observer. Uses the velocity property of
+   * the observer node if it has one, otherwise the change in position since
+   * its last update.
+   */
+  Vector3 get_observer_velocity(const Observer &observer,
+                                const Vector3 &position, float delta);
+
+  /**
+   * @brief Moves the load and retain boxes of the observer to its current
+   * position. Only the chunks entering or leaving the boxes are visited.
+   * Returns true if chunks were queued for loading or the load box moved.
+   */
+  bool update_observer(Observer &observer, float delta);
+
+  /**
+   * @brief Returns the box of chunks within radius of center.
+   */
+  ChunkBox chunk_box(const ChunkCoord &center, int64_t radius) const;
+
+  /**
+   * @brief Calls f for every chunk in a that is not in b.
+   */
+  template <typename F>
+  static void for_each_in_difference(const ChunkBox &a, const ChunkBox &b,
+                                     F f);
+
+  /**
+   * @brief Sorts the chunks waiting to be built so that the workers pick up
+   * the chunks closest to and ahead of any observer first.
+   */
+  void prioritize_chunks_to_load();
 
   /**
    * @brief Grabs a chunk from the chunk pool if one is available. Otherwise
@@ -59,29 +421,279 @@ class Terrain : public Spatial {
    */
   Chunk *acquire_chunk();
 
+  /**
+   * @brief Deletes pooled chunks while the pool exceeds _max_pooled_chunks or
+   * the chunks exceed the memory budget.
+   */
+  void trim_chunk_pool();
+
+  /**
+   * @brief The memory used by all loaded and pooled chunks and the arrays
+   * kept by the mesh cache.
+   */
+  size_t resident_bytes();
+
   NodePath _player_path;
   Spatial *_player;
 
+  std::vector<Observer> _observers;
+  /**
+   * @brief The number of observers whose retain box contains each chunk.
+   */
+  std::unordered_map<ChunkCoord, int64_t, ChunkCoordHash> _chunk_refs;
+
+  /**
+   * @brief The chunks waiting for their voxels, the workers take them from
+   * the back.
+   */
   std::vector<Chunk*> _chunks_to_load;
-  std::vector<Thread*> _worker_threads;
+  /**
+   * @brief The chunks whose voxels are filled, waiting for their mesh.
+   */
+  std::vector<Job> _chunks_to_mesh;
+  /**
+   * @brief The cached heights by column, x and z of the chunks with y 0.
+   */
+  std::unordered_map<ChunkCoord, std::unique_ptr<Column>, ChunkCoordHash>
+      _columns;
+  /**
+   * @brief The column of each chunk in _chunks_to_load. Chunks loaded from
+   * the baked world don't need heights and have none.
+   */
+  std::unordered_map<Chunk *, Column *> _chunk_columns;
+  /**
+   * @brief The number of jobs running per stage, and how many may. A limit
+   * of 0 doesn't limit the stage.
+   */
+  int64_t _running_jobs[STAGE_COUNT] = {0, 0, 0};
+  int64_t _max_height_jobs = 0;
+  int64_t _max_voxel_jobs = 0;
+  int64_t _max_mesh_jobs = 0;
+  std::vector<Ref<Thread>> _worker_threads;
+
+  /**
+   * @brief Bounds of the number of workers building chunks. A maximum of 0
+   * uses all cores but the reserved ones.
+   */
+  int64_t _min_workers = 1;
+  int64_t _max_workers = 0;
+  /**
+   * @brief Cores left to the engine's main, render and physics threads.
+   */
+  int64_t _reserved_cores = 2;
+  /**
+   * @brief Workers are parked while frames take longer than this.
+   */
+  double _frame_budget_ms = 20;
+  std::atomic<int64_t> _active_workers{0};
+  std::atomic<bool> _stopping_workers{false};
+  /**
+   * @brief Guards the queues and columns above. Workers wait on the
+   * condition for a job or for being activated.
+   */
+  std::mutex _jobs_mutex;
+  std::condition_variable _jobs_condition;
+  /**
+   * @brief The smoothed time between frames.
+   */
+  double _frame_ms = 0;
+  std::chrono::steady_clock::time_point _last_frame;
+  std::chrono::steady_clock::time_point _last_worker_update;
 
   std::vector<Chunk*> _loaded_chunks;
 
-  Semaphore *_available_chunks;
-  Mutex *_chunks_to_load_mutex;
+  /**
+   * @brief If true _ready queues the chunks around the spawn point for the
+   * workers instead of building them on the main thread. The chunks are
+   * integrated in bulk while the loading lasts, load_progress reports how many
+   * of them are active and terrain_ready is emitted once all are.
+   */
+  bool _async_startup = false;
+  /**
+   * @brief The chunks of the startup volume that aren't active yet.
+   */
+  std::unordered_set<ChunkCoord, ChunkCoordHash> _startup_chunks;
+  int64_t _startup_total = 0;
+  /**
+   * @brief The progress last reported by load_progress.
+   */
+  int64_t _startup_loaded = 0;
+  /**
+   * @brief True until terrain_ready was emitted.
+   */
+  bool _starting_up = false;
+
   Mutex *_loaded_chunks_mutex;
 
   std::vector<Chunk*> _chunk_pool;
   Mutex *_chunk_pool_mutex;
 
+  /**
+   * @brief If true chunks with identical meshes share their mesh and
+   * collision shape through _mesh_cache.
+   */
+  bool _share_meshes = true;
+  MeshCache _mesh_cache;
+
+  /**
+   * @brief If true chunks keep their cpu side meshes after uploading them.
+   */
+  bool _keep_mesh_data = false;
+
+  /**
+   * @brief If true the workers extract the walkable voxels of every chunk
+   * into _nav_graph for find_path. The agent needs _nav_clearance air voxels
+   * above the ground, climbs at most _nav_max_step voxels and drops at most
+   * _nav_max_drop voxels.
+   */
+  bool _navigation = false;
+  int64_t _nav_clearance = 2;
+  int64_t _nav_max_step = 1;
+  int64_t _nav_max_drop = 3;
+  NavGraph _nav_graph;
+
+  /**
+   * @brief If true the workers scatter grass, rocks and trees on the chunks,
+   * drawn with one multimesh per kind and chunk. The meshes are modelled for
+   * voxels of size 1, kinds without a mesh are left out. The density scales
+   * how many are placed.
+   */
+  bool _decorate = false;
+  double _decoration_density = 1;
+  Ref<Mesh> _grass_mesh;
+  Ref<Mesh> _rock_mesh;
+  Ref<Mesh> _tree_mesh;
+  /**
+   * @brief The bottom air of the sky above the world ceiling.
+   */
+  std::vector<uint8_t> _open_air;
+  int64_t _max_pooled_chunks = 256;
+  /**
+   * @brief The memory the chunks may use, 0 for no limit.
+   */
+  double _memory_budget_mb = 0;
+  bool _budget_warning_shown = false;
+  /**
+   * @brief The memory used by active chunks.
+   */
+  size_t _active_bytes = 0;
+
   Ref<OpenSimplexNoise> _noise;
 
+  /**
+   * @brief Creates the generator selected by _generator_type.
+   */
+  void create_generator();
+
+  /**
+   * @brief Opens the world baked by voxelbake at _baked_world_path and takes
+   * over the generator settings it was baked with, so chunks outside of the
+   * baked region match the baked ones.
+   */
+  void load_baked_world();
+
+  /**
+   * @brief A file written by voxelbake. Chunks in the file are loaded from it
+   * instead of being generated.
+   */
+  String _baked_world_path;
+  std::unique_ptr<BakedWorld> _baked_world;
+
+  /**
+   * @brief One of GeneratorType.
+   */
+  int64_t _generator_type = GENERATOR_NOISE;
+  std::unique_ptr<TerrainGenerator> _generator;
+
+  /**
+   * @brief The number of heightmap cells along each side of the island, and
+   * the island's height scale.
+   */
+  int64_t _island_size = 512;
+  double _island_height = 32;
+
+  /**
+   * @brief If true chunks add the 3d density of the generator to the
+   * heightfield, see Chunk::set_density.
+   */
+  bool _density = false;
+
+  /**
+   * @brief The seed of the terrain noise, unless _random_seed is set.
+   */
+  int64_t _seed = 0;
+  bool _random_seed = true;
+
+  /**
+   * @brief One layer per BlockTexture. Generated if not set.
+   */
+  Ref<TextureArray> _block_textures;
+
+  /**
+   * @brief The material shared by all chunks.
+   */
+  Ref<ShaderMaterial> _material;
+
   double _chunk_size = 16;
   int64_t _loaded_radius = 4;
   size_t _chunk_num_blocks = 16;
 
   int64_t _floor;
   int64_t _ceiling;
+
+  /**
+   * @brief If true the meshes of a block of _region_size^3 chunks are merged
+   * into a single region mesh.
+   */
+  bool _batch_regions = false;
+  int64_t _region_size = 4;
+  int64_t _region_rebuilds_per_frame = 2;
+
+  std::unordered_map<ChunkCoord, Region *, ChunkCoordHash> _regions;
+  std::vector<ChunkCoord> _dirty_regions;
+
+  bool _occlusion_culling = false;
+  /**
+   * @brief Set when chunks were added or removed, or the view moved to another
+   * chunk, since the last occlusion update.
+   */
+  bool _visibility_dirty = true;
+  ChunkCoord _view_chunk{0, 0, 0};
+
+  /**
+   * @brief If true the load volume is moved ahead of the player and chunks in
+   * the direction of motion are built first.
+   */
+  bool _prefetch = false;
+  /**
+   * @brief How many seconds of motion the load volume is moved ahead.
+   */
+  double _prefetch_time = 1.5;
+  /**
+   * @brief How many chunks nearer a chunk straight ahead counts as, compared
+   * to one beside the player, when ordering the build queue.
+   */
+  double _prefetch_bias = 2;
+
+  /**
+   * @brief How long the last call to _process took in microseconds.
+   */
+  double _process_usec = 0;
+
+  /**
+   * @brief Milliseconds from requesting to integrating each chunk loaded since
+   * the last call to get_statistics.
+   */
+  std::vector<double> _chunk_latencies;
+
+  /**
+   * @brief Builds stopped early because their chunk was unloaded.
+   */
+  std::atomic<int64_t> _cancelled_builds{0};
+  /**
+   * @brief Builds that finished although their chunk was already unloaded.
+   */
+  std::atomic<int64_t> _stale_builds{0};
 };
 }  // namespace godot
 
@@ -0,0 +1,43 @@
+#ifndef TERRAINGENERATOR_H
+#define TERRAINGENERATOR_H
+
+#include <algorithm>
+#include <cstddef>
+
+namespace godot {
+
+/**
+ * @brief Generates the terrain a block of samples at a time. Chunks request
+ * all the heights they need in one call, so implementations can vectorise and
+ * cache internally. Implementations are called from all worker threads at the
+ * same time.
+ */
+class TerrainGenerator {
+ public:
+  virtual ~TerrainGenerator() = default;
+
+  /**
+   * @brief Fills heights with the terrain height in world units of a grid of
+   * count_x * count_z columns. Column (i, j) lies at (x + i * step, z + j *
+   * step) and is written to heights[i + j * count_x].
+   */
+  virtual void generate_heights(double x, double z, double step,
+                                size_t count_x, size_t count_z,
+                                double *heights) = 0;
+
+  /**
+   * @brief Fills density with a 3d offset in world units that is added to the
+   * height above the heightfield surface, positive values add material. The
+   * lattice point (i, j, k) lies at (x + i * step, y + j * step, z + k * step)
+   * and is written to density[i + j * count_x + k * count_x * count_y]. The
+   * default adds nothing, so the terrain stays a pure heightfield.
+   */
+  virtual void generate_density(double x, double y, double z, double step,
+                                size_t count_x, size_t count_y, size_t count_z,
+                                double *density) {
+    std::fill(density, density + count_x * count_y * count_z, 0.0);
+  }
+};
+}  // namespace godot
+
+#endif  // TERRAINGENERATOR_H
@@ -0,0 +1,116 @@
+#include "Trace.h"
+
+#include <fstream>
+
+namespace godot {
+
+TraceRecorder &TraceRecorder::instance() {
+  static TraceRecorder recorder;
+  return recorder;
+}
+
+TraceRecorder::TraceRecorder() : _epoch(std::chrono::steady_clock::now()) {}
+
+void TraceRecorder::start() {
+  // The threads reset their own buffers once they see the new generation
+  _generation.fetch_add(1, std::memory_order_release);
+  _recording.store(true);
+}
+
+void TraceRecorder::stop() { _recording.store(false); }
+
+int64_t TraceRecorder::now() const {
+  using namespace std::chrono;
+  return duration_cast<microseconds>(steady_clock::now() - _epoch).count();
+}
+
+void TraceRecorder::record(const char *name, char phase, int64_t timestamp_us,
+                           int64_t duration_us, double x, double y, double z) {
+  Buffer *buffer = thread_buffer();
+  uint64_t generation = _generation.load(std::memory_order_acquire);
+  if (buffer->recording.load(std::memory_order_relaxed) != generation) {
+    buffer->written.store(0, std::memory_order_relaxed);
+    buffer->recording.store(generation, std::memory_order_release);
+  }
+  uint64_t index = buffer->written.load(std::memory_order_relaxed);
+  buffer->events[index % BUFFER_SIZE] =
+      Event{name, phase, timestamp_us, duration_us, x, y, z};
+  // Publish the event to write_json
+  buffer->written.store(index + 1, std::memory_order_release);
+}
+
+void TraceRecorder::set_thread_name(const char *name) {
+  thread_buffer()->name.store(name, std::memory_order_release);
+}
+
+TraceRecorder::Buffer *TraceRecorder::thread_buffer() {
+  thread_local Buffer *buffer = nullptr;
+  if (buffer == nullptr) {
+    std::unique_ptr<Buffer> created(new Buffer());
+    created->events.resize(BUFFER_SIZE);
+    buffer = created.get();
+
+    std::lock_guard<std::mutex> lock(_buffers_mutex);
+    created->tid = int32_t(_buffers.size()) + 1;
+    _buffers.push_back(std::move(created));
+  }
+  return buffer;
+}
+
+bool TraceRecorder::write_json(const std::string &path) {
+  std::ofstream file(path);
+  if (!file) {
+    return false;
+  }
+
+  std::lock_guard<std::mutex> lock(_buffers_mutex);
+  file << "{\"traceEvents\":[\n";
+  bool first = true;
+  auto separator = [&]() {
+    if (!first) {
+      file << ",\n";
+    }
+    first = false;
+  };
+
+  uint64_t generation = _generation.load(std::memory_order_acquire);
+  for (const std::unique_ptr<Buffer> &buffer : _buffers) {
+    const char *name = buffer->name.load(std::memory_order_acquire);
+    if (name != nullptr) {
+      separator();
+      file << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":"
+           << buffer->tid << ",\"args\":{\"name\":\"" << name << "\"}}";
+    }
+
+    // The thread hasn't recorded since the last start
+    if (buffer->recording.load(std::memory_order_acquire) != generation) {
+      continue;
+    }
+    uint64_t written = buffer->written.load(std::memory_order_acquire);
+    uint64_t begin = written > BUFFER_SIZE ? written - BUFFER_SIZE : 0;
+    for (uint64_t i = begin; i < written; ++i) {
+      const Event &e = buffer->events[i % BUFFER_SIZE];
+      separator();
+      file << "{\"name\":\"" << e.name << "\",\"ph\":\"" << e.phase
+           << "\",\"pid\":1,\"tid\":" << buffer->tid
+           << ",\"ts\":" << e.timestamp_us;
+      if (e.phase == 'X') {
+        file << ",\"dur\":" << e.duration_us;
+      }
+      if (e.phase == 'C') {
+        file << ",\"args\":{\"value\":" << e.x << "}}";
+      } else if (e.phase == 'E') {
+        file << "}";
+      } else {
+        if (e.phase == 'i') {
+          file << ",\"s\":\"t\"";
+        }
+        file << ",\"args\":{\"x\":" << e.x << ",\"y\":" << e.y
+             << ",\"z\":" << e.z << "}}";
+      }
+    }
+  }
+  file << "\n]}\n";
+  return bool(file);
+}
+}  // namespace godot
@@ -0,0 +1,189 @@
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+namespace godot {
+
+/**
+ * @brief Records a timeline of the chunk pipeline in the Chrome trace event
+ * format, which chrome://tracing and Perfetto open. Every thread writes into
+ * its own ring buffer, so recording takes no locks. Once a buffer is full the
+ * oldest events are overwritten.
+ *
+ * Use the VOXEL_TRACE_* macros to record events. They compile to nothing
+ * unless VOXEL_TRACE is defined.
+ */
+class TraceRecorder {
+ public:
+  /**
+   * @brief The number of events kept per thread.
+   */
+  static constexpr size_t BUFFER_SIZE = 1 << 16;
+
+  struct Event {
+    /**
+     * @brief Must be a string literal, only the pointer is stored.
+     */
+    const char *name;
+    /**
+     * @brief 'X' for complete events, 'B' and 'E' for the begin and end of a
+     * span, 'i' for instants and 'C' for counters.
+     */
+    char phase;
+    int64_t timestamp_us;
+    int64_t duration_us;
+    /**
+     * @brief The chunk coordinates, or the value of a counter in x.
+     */
+    double x, y, z;
+  };
+
+  static TraceRecorder &instance();
+
+  /**
+   * @brief Starts a new recording. Every thread drops the events of the
+   * previous recording when it records next.
+   */
+  void start();
+  void stop();
+  bool is_recording() const {
+    return _recording.load(std::memory_order_relaxed);
+  }
+
+  /**
+   * @brief Microseconds since the recorder was created.
+   */
+  int64_t now() const;
+
+  void record(const char *name, char phase, int64_t timestamp_us,
+              int64_t duration_us, double x, double y, double z);
+
+  /**
+   * @brief Names the calling thread in the trace.
+   */
+  void set_thread_name(const char *name);
+
+  /**
+   * @brief Writes the recorded events as trace event JSON. Recording should
+   * be stopped first, events written during the dump may be torn.
+   */
+  bool write_json(const std::string &path);
+
+ private:
+  struct Buffer {
+    std::vector<Event> events;
+    /**
+     * @brief The recording the events belong to and the number of events
+     * written since it started. Only the owning thread writes them.
+     */
+    std::atomic<uint64_t> recording{0};
+    std::atomic<uint64_t> written{0};
+    int32_t tid;
+    std::atomic<const char *> name{nullptr};
+  };
+
+  TraceRecorder();
+
+  /**
+   * @brief Returns the calling threads buffer, creating it on first use.
+   */
+  Buffer *thread_buffer();
+
+  std::chrono::steady_clock::time_point _epoch;
+  std::atomic<bool> _recording{false};
+  /**
+   * @brief Counts the calls to start, buffers of an older recording are
+   * empty.
+   */
+  std::atomic<uint64_t> _generation{0};
+
+  std::mutex _buffers_mutex;
+  std::vector<std::unique_ptr<Buffer>> _buffers;
+};
+
+/**
+ * @brief Records a complete event from construction to destruction.
+ */
+class TraceScope {
+ public:
+  TraceScope(const char *name, double x, double y, double z)
+      : _name(name), _x(x), _y(y), _z(z) {
+    TraceRecorder &recorder = TraceRecorder::instance();
+    _start = recorder.is_recording() ? recorder.now() : -1;
+  }
+
+  ~TraceScope() {
+    if (_start < 0) {
+      return;
+    }
+    TraceRecorder &recorder = TraceRecorder::instance();
+    recorder.record(_name, 'X', _start, recorder.now() - _start, _x, _y, _z);
+  }
+
+ private:
+  const char *_name;
+  double _x, _y, _z;
+  int64_t _start;
+};
+}  // namespace godot
+
+#ifdef VOXEL_TRACE
+#define VOXEL_TRACE_CONCAT_(a, b) a##b
+#define VOXEL_TRACE_CONCAT(a, b) VOXEL_TRACE_CONCAT_(a, b)
+/**
+ * @brief Records the time until the end of the enclosing scope.
+ */
+#define VOXEL_TRACE_SCOPE(name, x, y, z)                                 \
+  godot::TraceScope VOXEL_TRACE_CONCAT(voxel_trace_scope_, __LINE__)( \
+      name, x, y, z)
+/**
+ * @brief Records the begin and the end of a span that doesn't match a scope.
+ * Every begin needs an end on the same thread.
+ */
+#define VOXEL_TRACE_BEGIN(name, x, y, z)                              \
+  do {                                                                \
+    godot::TraceRecorder &recorder = godot::TraceRecorder::instance(); \
+    if (recorder.is_recording()) {                                    \
+      recorder.record(name, 'B', recorder.now(), 0, x, y, z);         \
+    }                                                                 \
+  } while (false)
+#define VOXEL_TRACE_END(name)                                         \
+  do {                                                                \
+    godot::TraceRecorder &recorder = godot::TraceRecorder::instance(); \
+    if (recorder.is_recording()) {                                    \
+      recorder.record(name, 'E', recorder.now(), 0, 0, 0, 0);         \
+    }                                                                 \
+  } while (false)
+#define VOXEL_TRACE_INSTANT(name, x, y, z)                            \
+  do {                                                                \
+    godot::TraceRecorder &recorder = godot::TraceRecorder::instance(); \
+    if (recorder.is_recording()) {                                    \
+      recorder.record(name, 'i', recorder.now(), 0, x, y, z);         \
+    }                                                                 \
+  } while (false)
+#define VOXEL_TRACE_COUNTER(name, value)                              \
+  do {                                                                \
+    godot::TraceRecorder &recorder = godot::TraceRecorder::instance(); \
+    if (recorder.is_recording()) {                                    \
+      recorder.record(name, 'C', recorder.now(), 0, value, 0, 0);     \
+    }                                                                 \
+  } while (false)
+#define VOXEL_TRACE_THREAD_NAME(name) \
+  godot::TraceRecorder::instance().set_thread_name(name)
+#else
+#define VOXEL_TRACE_SCOPE(name, x, y, z) ((void)0)
+#define VOXEL_TRACE_BEGIN(name, x, y, z) ((void)0)
+#define VOXEL_TRACE_END(name) ((void)0)
+#define VOXEL_TRACE_INSTANT(name, x, y, z) ((void)0)
+#define VOXEL_TRACE_COUNTER(name, value) ((void)0)
+#define VOXEL_TRACE_THREAD_NAME(name) ((void)0)
+#endif
+
+#endif  // TRACE_H
@@ -0,0 +1,61 @@
+#include "VoxelFiller.h"
+
+namespace godot {
+
+void VoxelFiller::sample(TerrainGenerator *generator, double x, double y,
+                         double z, double world_size, size_t n, bool density) {
+  _heights.resize(height_count(n));
+  sample_heights(generator, x, z, world_size, n, _heights.data());
+  sample(generator, x, y, z, world_size, n, density, _heights.data());
+}
+
+void VoxelFiller::sample(TerrainGenerator *generator, double x, double y,
+                         double z, double world_size, size_t n, bool density,
+                         const double *heights) {
+  _n = n;
+  _y = y;
+  _voxel_size = world_size / n;
+  _half_size = world_size / 2;
+  _density = density;
+  _height_stride = n + 2;
+  _height_data = heights;
+
+  // Sample the density on a coarse lattice. The last lattice point lies on or
+  // beyond the far chunk edge, so every voxel lies in a lattice cell.
+  _lattice_stride = (n + DENSITY_STEP - 1) / DENSITY_STEP + 1;
+  if (_density) {
+    _density_samples.resize(_lattice_stride * _lattice_stride *
+                            _lattice_stride);
+    generator->generate_density(x - _half_size, y - _half_size,
+                                z - _half_size, _voxel_size * DENSITY_STEP,
+                                _lattice_stride, _lattice_stride,
+                                _lattice_stride, _density_samples.data());
+  }
+}
+
+void VoxelFiller::sample_heights(TerrainGenerator *generator, double x,
+                                 double z, double world_size, size_t n,
+                                 double *heights) {
+  // The heights have a border of one voxel to compute the slope at the chunks
+  // edges
+  double voxel_size = world_size / n;
+  double half_size = world_size / 2;
+  size_t stride = n + 2;
+  generator->generate_heights(x - half_size - voxel_size,
+                              z - half_size - voxel_size, voxel_size, stride,
+                              stride, heights);
+}
+
+void VoxelFiller::fill(uint8_t *blocks) const {
+  switch (_n) {
+    case 16:
+      return fill(FixedSize<16>(), blocks);
+    case 32:
+      return fill(FixedSize<32>(), blocks);
+    case 64:
+      return fill(FixedSize<64>(), blocks);
+    default:
+      return fill(RuntimeSize{_n}, blocks);
+  }
+}
+}  // namespace godot
@@ -0,0 +1,213 @@
+#ifndef VOXELFILLER_H
+#define VOXELFILLER_H
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "BlockType.h"
+#include "TerrainGenerator.h"
+
+namespace godot {
+
+/**
+ * @brief The voxels along each side of a chunk as a compile time constant.
+ * The common sizes are built with it, so the compiler can fold the strides
+ * and unroll the loops over the voxels.
+ */
+template <size_t N>
+struct FixedSize {
+  static constexpr size_t get() { return N; }
+};
+
+/**
+ * @brief The fallback for sizes without a specialisation.
+ */
+struct RuntimeSize {
+  size_t n;
+  size_t get() const { return n; }
+};
+
+/**
+ * @brief Turns the heights and density of a TerrainGenerator into the blocks
+ * of a chunk. It doesn't use the engine, so the offline baker fills chunks
+ * exactly like Chunk does.
+ */
+class VoxelFiller {
+ public:
+  /**
+   * @brief The distance in voxels between the samples of the 3d density.
+   */
+  static constexpr size_t DENSITY_STEP = 4;
+
+  /**
+   * @brief Samples the generator for a chunk of n^3 voxels with the given
+   * extent, centered on (x, y, z). If density is set the 3d density is
+   * sampled every DENSITY_STEP voxels as well.
+   */
+  void sample(TerrainGenerator *generator, double x, double y, double z,
+              double world_size, size_t n, bool density);
+
+  /**
+   * @brief sample with heights taken from sample_heights instead of the
+   * generator. The heights must stay valid until fill returned.
+   */
+  void sample(TerrainGenerator *generator, double x, double y, double z,
+              double world_size, size_t n, bool density,
+              const double *heights);
+
+  /**
+   * @brief The number of heights of a column of chunks.
+   */
+  static size_t height_count(size_t n) { return (n + 2) * (n + 2); }
+
+  /**
+   * @brief Samples the heights of the column of chunks centered on x, z. All
+   * chunks of a column share them.
+   */
+  static void sample_heights(TerrainGenerator *generator, double x, double z,
+                             double world_size, size_t n, double *heights);
+
+  /**
+   * @brief Writes the blocks of the sampled chunk, indexed by voxel_index.
+   */
+  template <typename Size>
+  void fill(Size size, uint8_t *blocks) const;
+
+  /**
+   * @brief fill with the size specialised for 16, 32 and 64 voxels.
+   */
+  void fill(uint8_t *blocks) const;
+
+  template <typename Size>
+  static size_t voxel_index(Size size, size_t x, size_t y, size_t z) {
+    return x + z * size.get() + y * size.get() * size.get();
+  }
+
+  /**
+   * @brief Writes the air voxels at the bottom of each column x + z * n of the
+   * blocks, n if the column is all air and at most 255. The chunk below needs
+   * them for the air above its top layer.
+   */
+  template <typename Size>
+  static void bottom_air(const uint8_t *blocks, Size size,
+                         std::vector<uint8_t> *air);
+
+ private:
+  size_t _n = 0;
+  double _y = 0;
+  double _voxel_size = 1;
+  double _half_size = 0.5;
+  bool _density = false;
+
+  /**
+   * @brief The heights have a border of one voxel to compute the slope at the
+   * chunks edges.
+   */
+  size_t _height_stride = 0;
+  std::vector<double> _heights;
+  /**
+   * @brief Either _heights or the heights of the column.
+   */
+  const double *_height_data = nullptr;
+
+  size_t _lattice_stride = 0;
+  std::vector<double> _density_samples;
+};
+
+template <typename Size>
+void VoxelFiller::bottom_air(const uint8_t *blocks, Size size,
+                             std::vector<uint8_t> *air) {
+  const size_t n = size.get();
+  air->assign(n * n, 0);
+  for (size_t z = 0; z < n; ++z) {
+    for (size_t x = 0; x < n; ++x) {
+      size_t y = 0;
+      while (y < n &&
+             Block(blocks[voxel_index(size, x, y, z)]) == Block::AIR) {
+        y++;
+      }
+      (*air)[x + z * n] = uint8_t(y < 255 ? y : 255);
+    }
+  }
+}
+
+template <typename Size>
+void VoxelFiller::fill(Size size, uint8_t *blocks) const {
+  // Columns whose surface lies below this height are covered in sand
+  constexpr double SAND_LEVEL = -8;
+  // Surfaces steeper than this (rise over run) expose bare stone
+  constexpr double MAX_GRASS_SLOPE = 1.5;
+  // The number of voxels of dirt below the grass
+  constexpr double DIRT_DEPTH = 3;
+
+  // A compile time constant for the specialised sizes
+  const size_t n = size.get();
+  const size_t height_stride = n + 2;
+  const size_t lattice_stride = _lattice_stride;
+  const double voxel_size = _voxel_size;
+  const double half_size = _half_size;
+
+  for (size_t z = 0; z < n; ++z) {
+    for (size_t x = 0; x < n; ++x) {
+      const double *heights = _height_data;
+      size_t h = (x + 1) + (z + 1) * height_stride;
+      double height = heights[h];
+      double dx = (heights[h + 1] - heights[h - 1]) / (2 * voxel_size);
+      double dz = (heights[h + height_stride] - heights[h - height_stride]) /
+                  (2 * voxel_size);
+      double slope = std::sqrt(dx * dx + dz * dz);
+
+      Block surface = Block::GRASS;
+      Block below_surface = Block::DIRT;
+      if (slope > MAX_GRASS_SLOPE) {
+        surface = Block::STONE;
+        below_surface = Block::STONE;
+      } else if (height < SAND_LEVEL) {
+        surface = Block::SAND;
+        below_surface = Block::SAND;
+      }
+
+      // The lattice cell and the interpolation weights of the column
+      size_t lx = x / DENSITY_STEP;
+      size_t lz = z / DENSITY_STEP;
+      double tx = double(x % DENSITY_STEP) / DENSITY_STEP;
+      double tz = double(z % DENSITY_STEP) / DENSITY_STEP;
+
+      for (size_t y = 0; y < n; ++y) {
+        double world_y = _y + y * voxel_size - half_size;
+        double offset = 0;
+        if (_density) {
+          size_t ly = y / DENSITY_STEP;
+          double ty = double(y % DENSITY_STEP) / DENSITY_STEP;
+          const double *d = &_density_samples[lx + (ly + lz * lattice_stride) *
+                                                        lattice_stride];
+          size_t sy = lattice_stride;
+          size_t sz = lattice_stride * lattice_stride;
+          double d00 = d[0] + (d[1] - d[0]) * tx;
+          double d10 = d[sy] + (d[sy + 1] - d[sy]) * tx;
+          double d01 = d[sz] + (d[sz + 1] - d[sz]) * tx;
+          double d11 = d[sy + sz] + (d[sy + sz + 1] - d[sy + sz]) * tx;
+          double d0 = d00 + (d10 - d00) * ty;
+          double d1 = d01 + (d11 - d01) * ty;
+          offset = d0 + (d1 - d0) * tz;
+        }
+        // The depth below the surface in voxels
+        double depth = (height - world_y + offset) / voxel_size;
+        Block b = Block::AIR;
+        if (depth > DIRT_DEPTH + 1) {
+          b = Block::STONE;
+        } else if (depth > 1) {
+          b = below_surface;
+        } else if (depth > 0) {
+          b = surface;
+        }
+        blocks[voxel_index(size, x, y, z)] = uint8_t(b);
+      }
+    }
+  }
+}
+}  // namespace godot
+
+#endif  // VOXELFILLER_H
@@ -0,0 +1,209 @@
+#include "VoxelStorage.h"
+
+#include <array>
+
+#include "BlockType.h"
+
+namespace godot {
+
+VoxelStorage::VoxelStorage() : _size(0), _bits(0), _palette(1, 0) {}
+
+void VoxelStorage::reset(size_t count) {
+  _size = count;
+  _bits = 0;
+  _palette.assign(1, 0);
+  _words.clear();
+  _words.shrink_to_fit();
+}
+
+void VoxelStorage::assign(const uint8_t *blocks, size_t count) {
+  // Maps block ids to their palette index, 0xFF marks unused ids
+  std::array<uint8_t, 256> lookup;
+  lookup.fill(0xFF);
+
+  _palette.clear();
+  for (size_t i = 0; i < count; ++i) {
+    if (lookup[blocks[i]] == 0xFF) {
+      lookup[blocks[i]] = _palette.size();
+      _palette.push_back(blocks[i]);
+    }
+  }
+  if (_palette.empty()) {
+    _palette.push_back(0);
+  }
+
+  _size = count;
+  _bits = bits_for_palette(_palette.size());
+  _words.assign(_bits == 0 ? 0 : (_size * _bits + 63) / 64, 0);
+  _words.shrink_to_fit();
+  if (_bits == 0) {
+    return;
+  }
+
+  size_t per_word = 64 / _bits;
+  for (size_t w = 0; w < _words.size(); ++w) {
+    uint64_t word = 0;
+    size_t begin = w * per_word;
+    size_t end = begin + per_word < count ? begin + per_word : count;
+    for (size_t i = begin; i < end; ++i) {
+      word |= uint64_t(lookup[blocks[i]]) << ((i - begin) * _bits);
+    }
+    _words[w] = word;
+  }
+}
+
+uint8_t VoxelStorage::get(size_t index) const {
+  return _palette[index_of(index)];
+}
+
+void VoxelStorage::set(size_t index, uint8_t block) {
+  size_t palette_index = 0;
+  while (palette_index < _palette.size() && _palette[palette_index] != block) {
+    palette_index++;
+  }
+  if (palette_index == _palette.size()) {
+    _palette.push_back(block);
+    size_t bits = bits_for_palette(_palette.size());
+    if (bits != _bits) {
+      repack(bits);
+    }
+  }
+  set_index(index, palette_index);
+}
+
+void VoxelStorage::unpack(uint8_t *out) const {
+  if (_bits == 0) {
+    for (size_t i = 0; i < _size; ++i) {
+      out[i] = _palette[0];
+    }
+    return;
+  }
+  size_t per_word = 64 / _bits;
+  uint64_t mask = (uint64_t(1) << _bits) - 1;
+  for (size_t i = 0; i < _size; ++i) {
+    uint64_t word = _words[i / per_word];
+    out[i] = _palette[(word >> ((i % per_word) * _bits)) & mask];
+  }
+}
+
+size_t VoxelStorage::size() const { return _size; }
+
+size_t VoxelStorage::bits_per_voxel() const { return _bits; }
+
+const std::vector<uint8_t> &VoxelStorage::palette() const { return _palette; }
+
+size_t VoxelStorage::memory_usage() const {
+  return _palette.capacity() * sizeof(uint8_t) +
+         _words.capacity() * sizeof(uint64_t);
+}
+
+void VoxelStorage::write(std::ostream &out) const {
+  uint32_t size = uint32_t(_size);
+  uint8_t bits = uint8_t(_bits);
+  uint16_t palette_size = uint16_t(_palette.size());
+  out.write(reinterpret_cast<const char *>(&size), sizeof(size));
+  out.write(reinterpret_cast<const char *>(&bits), sizeof(bits));
+  out.write(reinterpret_cast<const char *>(&palette_size),
+            sizeof(palette_size));
+  out.write(reinterpret_cast<const char *>(_palette.data()), palette_size);
+  out.write(reinterpret_cast<const char *>(_words.data()),
+            _words.size() * sizeof(uint64_t));
+}
+
+bool VoxelStorage::read(std::istream &in) {
+  uint32_t size;
+  uint8_t bits;
+  uint16_t palette_size;
+  in.read(reinterpret_cast<char *>(&size), sizeof(size));
+  in.read(reinterpret_cast<char *>(&bits), sizeof(bits));
+  in.read(reinterpret_cast<char *>(&palette_size), sizeof(palette_size));
+  if (!in || palette_size == 0 || palette_size > 256 ||
+      bits != bits_for_palette(palette_size)) {
+    return false;
+  }
+  std::vector<uint8_t> palette(palette_size);
+  in.read(reinterpret_cast<char *>(palette.data()), palette_size);
+  std::vector<uint64_t> words(bits == 0 ? 0 : (size_t(size) * bits + 63) / 64);
+  in.read(reinterpret_cast<char *>(words.data()),
+          words.size() * sizeof(uint64_t));
+  if (!in) {
+    return false;
+  }
+  // The data may come from a file, get and unpack mustn't read past the
+  // palette or hand out ids that aren't blocks
+  for (uint8_t block : palette) {
+    if (block >= uint8_t(Block::COUNT)) {
+      return false;
+    }
+  }
+  if (bits > 0 && palette_size < (size_t(1) << bits)) {
+    size_t per_word = 64 / bits;
+    uint64_t mask = (uint64_t(1) << bits) - 1;
+    for (size_t i = 0; i < size; ++i) {
+      if (((words[i / per_word] >> ((i % per_word) * bits)) & mask) >=
+          palette_size) {
+        return false;
+      }
+    }
+  }
+
+  _size = size;
+  _bits = bits;
+  _palette = std::move(palette);
+  _words = std::move(words);
+  return true;
+}
+
+size_t VoxelStorage::bits_for_palette(size_t palette_size) {
+  // Only use bit widths that divide 64, so no index spans two words.
+  if (palette_size <= 1) {
+    return 0;
+  } else if (palette_size <= 2) {
+    return 1;
+  } else if (palette_size <= 4) {
+    return 2;
+  } else if (palette_size <= 16) {
+    return 4;
+  }
+  return 8;
+}
+
+void VoxelStorage::repack(size_t bits) {
+  std::vector<uint64_t> old_words;
+  old_words.swap(_words);
+  size_t old_bits = _bits;
+
+  _bits = bits;
+  _words.assign((_size * _bits + 63) / 64, 0);
+  for (size_t i = 0; i < _size; ++i) {
+    size_t palette_index = 0;
+    if (old_bits > 0) {
+      size_t per_word = 64 / old_bits;
+      uint64_t mask = (uint64_t(1) << old_bits) - 1;
+      palette_index =
+          (old_words[i / per_word] >> ((i % per_word) * old_bits)) & mask;
+    }
+    set_index(i, palette_index);
+  }
+}
+
+size_t VoxelStorage::index_of(size_t index) const {
+  if (_bits == 0) {
+    return 0;
+  }
+  size_t per_word = 64 / _bits;
+  uint64_t mask = (uint64_t(1) << _bits) - 1;
+  return (_words[index / per_word] >> ((index % per_word) * _bits)) & mask;
+}
+
+void VoxelStorage::set_index(size_t index, size_t palette_index) {
+  if (_bits == 0) {
+    return;
+  }
+  size_t per_word = 64 / _bits;
+  size_t shift = (index % per_word) * _bits;
+  uint64_t mask = ((uint64_t(1) << _bits) - 1) << shift;
+  uint64_t &word = _words[index / per_word];
+  word = (word & ~mask) | ((uint64_t(palette_index) << shift) & mask);
+}
+}  // namespace godot
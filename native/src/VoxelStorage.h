@@ -0,0 +1,82 @@
+#ifndef VOXELSTORAGE_H
+#define VOXELSTORAGE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+namespace godot {
+
+/**
+ * @brief Stores one block id per voxel as a small palette of the distinct ids
+ * plus a bit packed array of palette indices. Chunks usually contain only a
+ * handful of block types, so most of them need 1 or 2 bits per voxel and
+ * uniform chunks (e.g. all air) need no index bits at all.
+ */
+class VoxelStorage {
+ public:
+  VoxelStorage();
+
+  /**
+   * @brief Resizes the storage to count voxels, all set to block 0 (air).
+   */
+  void reset(size_t count);
+
+  /**
+   * @brief Replaces the whole content with the given unpacked block ids. This
+   * builds the palette and packs the indices in a single pass and is much
+   * cheaper than calling set for every voxel.
+   */
+  void assign(const uint8_t *blocks, size_t count);
+
+  uint8_t get(size_t index) const;
+  void set(size_t index, uint8_t block);
+
+  /**
+   * @brief Writes the unpacked block ids of all voxels into out.
+   */
+  void unpack(uint8_t *out) const;
+
+  size_t size() const;
+  size_t bits_per_voxel() const;
+  const std::vector<uint8_t> &palette() const;
+
+  /**
+   * @brief The number of bytes used by the palette and the packed indices.
+   */
+  size_t memory_usage() const;
+
+  /**
+   * @brief Writes the palette and packed indices as they are, in the byte
+   * order of the machine.
+   */
+  void write(std::ostream &out) const;
+
+  /**
+   * @brief Reads what write wrote. Returns false and leaves the storage
+   * unchanged if the data is truncated or inconsistent, or if it holds
+   * palette indices or block ids out of range.
+   */
+  bool read(std::istream &in);
+
+ private:
+  static size_t bits_for_palette(size_t palette_size);
+
+  /**
+   * @brief Repacks the indices using the given number of bits per voxel.
+   */
+  void repack(size_t bits);
+
+  size_t index_of(size_t index) const;
+  void set_index(size_t index, size_t palette_index);
+
+  size_t _size;
+  size_t _bits;
+  std::vector<uint8_t> _palette;
+  std::vector<uint64_t> _words;
+};
+}  // namespace godot
+
+#endif  // VOXELSTORAGE_H
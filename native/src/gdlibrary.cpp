@@ -2,6 +2,7 @@
 
 #include "Terrain.h"
 #include "Chunk.h"
+#include "HeightMapMesher.h"
 
 extern "C" void GDN_EXPORT godot_gdnative_init(godot_gdnative_init_options *o) {
     godot::Godot::gdnative_init(o);
@@ -15,4 +16,5 @@ extern "C" void GDN_EXPORT godot_nativescript_init(void *handle) {
     godot::Godot::nativescript_init(handle);
 
     godot::register_class<godot::Terrain>();
+    godot::register_class<godot::HeightMapMesher>();
 }
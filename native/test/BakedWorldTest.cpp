@@ -0,0 +1,183 @@
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdio>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BakedWorld.h"
+#include "VoxelStorage.h"
+
+namespace {
+godot::VoxelStorage make_voxels(uint8_t seed) {
+  std::vector<uint8_t> blocks(4096);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    blocks[i] = (i * seed) % 5;
+  }
+  godot::VoxelStorage voxels;
+  voxels.assign(blocks.data(), blocks.size());
+  return voxels;
+}
+
+std::vector<uint8_t> unpacked(const godot::VoxelStorage &voxels) {
+  std::vector<uint8_t> blocks(voxels.size());
+  voxels.unpack(blocks.data());
+  return blocks;
+}
+
+std::string temp_path(const char *name) {
+  std::string path = testing::TempDir() + name;
+  std::remove(path.c_str());
+  return path;
+}
+}  // namespace
+
+TEST(BakedWorldTest, appendedChunksReadBack) {
+  std::string path = temp_path("appended.vxb");
+  godot::BakedWorld::Settings settings;
+  settings.seed = 7;
+  {
+    godot::BakedWorld world;
+    ASSERT_TRUE(world.open_for_append(path, settings));
+    EXPECT_TRUE(world.append(1, -2, 3, make_voxels(3)));
+    EXPECT_TRUE(world.append(-4, 0, 5, make_voxels(7)));
+  }
+
+  godot::BakedWorld world;
+  ASSERT_TRUE(world.open(path));
+  EXPECT_EQ(settings, world.settings());
+  EXPECT_EQ(2, world.size());
+
+  godot::VoxelStorage voxels;
+  ASSERT_TRUE(world.read(1, -2, 3, &voxels));
+  EXPECT_EQ(unpacked(make_voxels(3)), unpacked(voxels));
+  ASSERT_TRUE(world.read(-4, 0, 5, &voxels));
+  EXPECT_EQ(unpacked(make_voxels(7)), unpacked(voxels));
+  EXPECT_FALSE(world.read(0, 0, 0, &voxels));
+}
+
+TEST(BakedWorldTest, resumeDropsPartialRecord) {
+  std::string path = temp_path("partial.vxb");
+  godot::BakedWorld::Settings settings;
+  {
+    godot::BakedWorld world;
+    ASSERT_TRUE(world.open_for_append(path, settings));
+    EXPECT_TRUE(world.append(0, 0, 0, make_voxels(3)));
+  }
+  {
+    // An interrupted bake leaves half a record behind
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    int32_t coords[3] = {1, 1, 1};
+    uint32_t length = 1000;
+    file.write(reinterpret_cast<const char *>(coords), sizeof(coords));
+    file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    file.write("abc", 3);
+  }
+  {
+    godot::BakedWorld world;
+    ASSERT_TRUE(world.open_for_append(path, settings));
+    EXPECT_EQ(1, world.size());
+    EXPECT_FALSE(world.contains(1, 1, 1));
+    EXPECT_TRUE(world.append(1, 1, 1, make_voxels(7)));
+  }
+
+  godot::BakedWorld world;
+  ASSERT_TRUE(world.open(path));
+  EXPECT_EQ(2, world.size());
+  godot::VoxelStorage voxels;
+  ASSERT_TRUE(world.read(1, 1, 1, &voxels));
+  EXPECT_EQ(unpacked(make_voxels(7)), unpacked(voxels));
+}
+
+TEST(BakedWorldTest, otherSettingsAreRejected) {
+  std::string path = temp_path("settings.vxb");
+  godot::BakedWorld::Settings settings;
+  {
+    godot::BakedWorld world;
+    ASSERT_TRUE(world.open_for_append(path, settings));
+  }
+  settings.seed = 1;
+  godot::BakedWorld world;
+  EXPECT_FALSE(world.open_for_append(path, settings));
+}
+
+TEST(BakedWorldTest, corruptRecordsAreRejected) {
+  std::string path = temp_path("corrupt.vxb");
+  godot::BakedWorld::Settings settings;
+  {
+    godot::BakedWorld world;
+    ASSERT_TRUE(world.open_for_append(path, settings));
+  }
+
+  // Appends a record whose storage has 3 palette entries at 2 bits
+  auto append_record = [&](int32_t x, uint8_t block, uint64_t word) {
+    std::ofstream file(path, std::ios::binary | std::ios::app);
+    uint32_t size = 32;
+    uint8_t bits = 2;
+    uint16_t palette_size = 3;
+    uint8_t palette[3] = {0, 1, block};
+    uint32_t length = sizeof(size) + sizeof(bits) + sizeof(palette_size) +
+                      sizeof(palette) + sizeof(word);
+    int32_t coords[3] = {x, 0, 0};
+    file.write(reinterpret_cast<const char *>(coords), sizeof(coords));
+    file.write(reinterpret_cast<const char *>(&length), sizeof(length));
+    file.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    file.write(reinterpret_cast<const char *>(&bits), sizeof(bits));
+    file.write(reinterpret_cast<const char *>(&palette_size),
+               sizeof(palette_size));
+    file.write(reinterpret_cast<const char *>(palette), sizeof(palette));
+    file.write(reinterpret_cast<const char *>(&word), sizeof(word));
+  };
+  // Every voxel uses index 2
+  append_record(1, 2, 0xAAAAAAAAAAAAAAAAULL);
+  // Index 3 points past the palette
+  append_record(2, 2, 0xFFFFFFFFFFFFFFFFULL);
+  // 200 isn't a block
+  append_record(3, 200, 0);
+
+  godot::BakedWorld world;
+  ASSERT_TRUE(world.open(path));
+  godot::VoxelStorage voxels;
+  ASSERT_TRUE(world.read(1, 0, 0, &voxels));
+  EXPECT_EQ(2, voxels.get(31));
+  EXPECT_FALSE(world.read(2, 0, 0, &voxels));
+  EXPECT_FALSE(world.read(3, 0, 0, &voxels));
+  // A rejected record leaves the storage alone
+  EXPECT_EQ(2, voxels.get(31));
+}
+
+TEST(BakedWorldTest, chunksAreReadConcurrently) {
+  std::string path = temp_path("concurrent.vxb");
+  godot::BakedWorld::Settings settings;
+  {
+    godot::BakedWorld world;
+    ASSERT_TRUE(world.open_for_append(path, settings));
+    for (int64_t x = 0; x < 8; ++x) {
+      EXPECT_TRUE(world.append(x, 0, 0, make_voxels(uint8_t(x + 1))));
+    }
+  }
+
+  godot::BakedWorld world;
+  ASSERT_TRUE(world.open(path));
+  std::remove(path.c_str());
+  std::atomic<int> failures{0};
+  std::vector<std::thread> threads;
+  for (int64_t t = 0; t < 4; ++t) {
+    threads.emplace_back([&, t]() {
+      godot::VoxelStorage voxels;
+      for (int64_t i = 0; i < 64; ++i) {
+        int64_t x = (i + t) % 8;
+        if (!world.read(x, 0, 0, &voxels) ||
+            unpacked(voxels) != unpacked(make_voxels(uint8_t(x + 1)))) {
+          failures++;
+        }
+      }
+    });
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  EXPECT_EQ(0, failures);
+}
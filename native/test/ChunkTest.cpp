@@ -1,8 +1,96 @@
 #include <gtest/gtest.h>
 
+#include <OpenSimplexNoise.hpp>
+#include <algorithm>
+
 #include "Chunk.h"
+#include "MeshCache.h"
+#include "NoiseGenerator.h"
 
 TEST(ChunkTest, generateTerrain) {
+  godot::NoiseGenerator generator(godot::OpenSimplexNoise::_new());
+  godot::Chunk chunk;
+  chunk.set_generator(&generator);
+  chunk.build_terrain();
+}
+
+namespace {
+/**
+ * @brief Flat ground slightly above 0, so no voxel boundary lies exactly on a
+ * material threshold.
+ */
+class FlatGenerator : public godot::TerrainGenerator {
+ public:
+  explicit FlatGenerator(double height = 0.1) : _height(height) {}
+
+  void generate_heights(double x, double z, double step, size_t count_x,
+                        size_t count_z, double *heights) override {
+    std::fill(heights, heights + count_x * count_z, _height);
+  }
+
+ private:
+  double _height;
+};
+
+void expect_flat_ground(size_t divisions) {
+  FlatGenerator generator;
+  godot::Chunk chunk;
+  chunk.set_generator(&generator);
+  chunk.set_size(divisions);
+  chunk.set_world_size(16);
+  chunk.build_terrain();
+
+  // The ground lies at half height, with 4 voxels of grass and dirt on top of
+  // the stone
+  size_t ground = divisions / 2;
+  for (size_t y = 0; y < divisions; ++y) {
+    godot::Block expected = godot::Block::AIR;
+    if (y + 4 <= ground) {
+      expected = godot::Block::STONE;
+    } else if (y < ground) {
+      expected = godot::Block::DIRT;
+    } else if (y == ground) {
+      expected = godot::Block::GRASS;
+    }
+    EXPECT_EQ(expected, chunk.get_block(divisions - 1, y, divisions / 3))
+        << "divisions " << divisions << " y " << y;
+  }
+}
+}  // namespace
+
+TEST(ChunkTest, specialisedSizesDecoupleWorldSize) {
+  expect_flat_ground(16);
+  expect_flat_ground(32);
+  expect_flat_ground(64);
+}
+
+TEST(ChunkTest, unspecialisedSizeFallsBack) { expect_flat_ground(24); }
+
+TEST(ChunkTest, identicalMeshesHashEqually) {
+  FlatGenerator flat;
+  FlatGenerator raised(4.1);
+  godot::MeshCache cache;
+  godot::Chunk a, b, c;
+  for (godot::Chunk *chunk : {&a, &b, &c}) {
+    chunk->set_mesh_cache(&cache);
+  }
+  a.set_generator(&flat);
+  b.set_generator(&flat);
+  c.set_generator(&raised);
+  // Mesh vertices are relative to the chunk, so the position doesn't matter
+  b.position = godot::Vector3(160, 0, -32);
+  a.build_terrain();
+  b.build_terrain();
+  c.build_terrain();
+
+  EXPECT_EQ(a.get_mesh_data().hash, b.get_mesh_data().hash);
+  EXPECT_NE(a.get_mesh_data().hash, c.get_mesh_data().hash);
+}
+
+TEST(ChunkTest, meshesAreOnlyHashedForACache) {
+  FlatGenerator flat;
   godot::Chunk chunk;
+  chunk.set_generator(&flat);
   chunk.build_terrain();
+  EXPECT_EQ(0u, chunk.get_mesh_data().hash);
 }
@@ -0,0 +1,104 @@
+#include <gtest/gtest.h>
+
+#include <cmath>
+#include <vector>
+
+#include "BlockType.h"
+#include "Decorator.h"
+
+namespace {
+constexpr size_t N = 16;
+constexpr godot::FixedSize<N> SIZE;
+
+/**
+ * @brief Grass up to height, on top of stone.
+ */
+std::vector<uint8_t> make_blocks(size_t height) {
+  std::vector<uint8_t> blocks(N * N * N, uint8_t(godot::Block::AIR));
+  for (size_t y = 0; y < height; ++y) {
+    for (size_t i = 0; i < N * N; ++i) {
+      blocks[i + y * N * N] = uint8_t(y + 1 == height ? godot::Block::GRASS
+                                                      : godot::Block::STONE);
+    }
+  }
+  return blocks;
+}
+
+size_t total(const godot::DecorationSet &set) {
+  size_t count = 0;
+  for (size_t i = 0; i < godot::DECORATION_COUNT; ++i) {
+    count += set.count(godot::Decoration(i));
+  }
+  return count;
+}
+}  // namespace
+
+TEST(DecoratorTest, placementsAreDeterministic) {
+  std::vector<uint8_t> blocks = make_blocks(8);
+  godot::DecorationSet a, b, moved;
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 2, 0, -1, 7, 1, &a);
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 2, 0, -1, 7, 1, &b);
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 3, 0, -1, 7, 1, &moved);
+
+  ASSERT_GT(total(a), 0u);
+  for (size_t i = 0; i < godot::DECORATION_COUNT; ++i) {
+    EXPECT_EQ(a.transforms[i], b.transforms[i]);
+  }
+  EXPECT_NE(a.transforms[size_t(godot::Decoration::GRASS)],
+            moved.transforms[size_t(godot::Decoration::GRASS)]);
+}
+
+TEST(DecoratorTest, decorationsStandOnTheSurface) {
+  std::vector<uint8_t> blocks = make_blocks(8);
+  godot::DecorationSet set;
+  godot::Decorator::scatter(blocks.data(), SIZE, 32, 0, 0, 0, 3, 1, &set);
+
+  // The ground lies at the chunk's center, voxels are 2 units
+  for (size_t i = 0; i < godot::DECORATION_COUNT; ++i) {
+    const std::vector<float> &t = set.transforms[i];
+    for (size_t j = 0; j < t.size();
+         j += godot::DecorationSet::FLOATS_PER_INSTANCE) {
+      EXPECT_FLOAT_EQ(0, t[j + 7]);
+      EXPECT_LT(std::abs(t[j + 3]), 16);
+      EXPECT_LT(std::abs(t[j + 11]), 16);
+    }
+  }
+  // Only grass grows on grass
+  EXPECT_EQ(0u, set.count(godot::Decoration::ROCK));
+}
+
+TEST(DecoratorTest, densityScalesPlacements) {
+  std::vector<uint8_t> blocks = make_blocks(8);
+  godot::DecorationSet none, some, more;
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 0, 0, 0, 1, 0, &none);
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 0, 0, 0, 1, 0.5, &some);
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 0, 0, 0, 1, 2, &more);
+  EXPECT_EQ(0u, total(none));
+  EXPECT_LT(total(some), total(more));
+
+  std::vector<uint8_t> air = make_blocks(0);
+  godot::Decorator::scatter(air.data(), SIZE, 16, 0, 0, 0, 1, 2, &none);
+  EXPECT_EQ(0u, total(none));
+}
+
+TEST(DecoratorTest, buriedTopLayerWaitsForTheChunkAbove) {
+  std::vector<uint8_t> blocks = make_blocks(N);
+  godot::DecorationSet set;
+  godot::Decorator::scatter(blocks.data(), SIZE, 16, 0, -1, 0, 5, 2, &set);
+
+  // Without the chunk above nothing counts as exposed
+  EXPECT_EQ(0u, total(set));
+  ASSERT_FALSE(set.pending.empty());
+  for (const godot::DecorationSet::Pending &p : set.pending) {
+    EXPECT_GE(p.air, 1u);
+    EXPECT_FLOAT_EQ(8, p.transform[7]);
+  }
+
+  // An all air chunk above confirms them
+  std::vector<uint8_t> air = make_blocks(0);
+  std::vector<uint8_t> above_air;
+  godot::VoxelFiller::bottom_air(air.data(), SIZE, &above_air);
+  for (const godot::DecorationSet::Pending &p : set.pending) {
+    EXPECT_GE(above_air[p.column], p.air);
+  }
+}
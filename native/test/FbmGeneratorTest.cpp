@@ -0,0 +1,55 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "FbmGenerator.h"
+
+TEST(FbmGeneratorTest, noiseIsDeterministicAndBounded) {
+  godot::Noise a(42);
+  godot::Noise b(42);
+  for (int i = 0; i < 1000; ++i) {
+    double x = i * 0.37 - 150;
+    double z = i * 0.61 - 300;
+    double n = a.sample(x, z);
+    EXPECT_EQ(n, b.sample(x, z));
+    EXPECT_LE(n, 1.0);
+    EXPECT_GE(n, -1.0);
+  }
+}
+
+TEST(FbmGeneratorTest, seedChangesNoise) {
+  godot::Noise a(1);
+  godot::Noise b(2);
+  int differences = 0;
+  for (int i = 0; i < 100; ++i) {
+    double x = i * 0.5 + 0.25;
+    differences += a.sample(x, 0.25) != b.sample(x, 0.25);
+  }
+  EXPECT_GT(differences, 90);
+}
+
+TEST(FbmGeneratorTest, batchMatchesPointSamples) {
+  auto generator = godot::create_fbm_generator(godot::FbmPreset::MOUNTAINS, 7);
+  std::vector<double> heights(18 * 18);
+  generator->generate_heights(-8.5, 3.5, 0.5, 18, 18, heights.data());
+
+  godot::Noise noise(7);
+  for (size_t j = 0; j < 18; ++j) {
+    for (size_t i = 0; i < 18; ++i) {
+      EXPECT_DOUBLE_EQ(godot::fbm::Mountains::sample(noise, -8.5 + i * 0.5,
+                                                     3.5 + j * 0.5),
+                       heights[i + j * 18]);
+    }
+  }
+}
+
+TEST(FbmGeneratorTest, densityLatticeLayout) {
+  auto generator = godot::create_fbm_generator(godot::FbmPreset::HILLS, 3);
+  std::vector<double> density(5 * 4 * 3);
+  generator->generate_density(1, 2, 3, 4, 5, 4, 3, density.data());
+
+  godot::Noise noise(3);
+  EXPECT_DOUBLE_EQ(godot::fbm::Overhangs::sample(noise, 1 + 2 * 4, 2 + 3 * 4,
+                                                 3 + 1 * 4),
+                   density[2 + 3 * 5 + 1 * 5 * 4]);
+}
@@ -0,0 +1,34 @@
+#include <gtest/gtest.h>
+
+#include "HeightMap.h"
+#include "HeightMapMesher.h"
+
+TEST(HeightMapMesherTest, verticesTakeTheHeightMapHeights) {
+  constexpr size_t CELLS = 16;
+  constexpr double CELL_SIZE = 2.5;
+  godot::Ref<godot::HeightMapMesher> mesher(godot::HeightMapMesher::_new());
+  mesher->generate(CELLS, CELL_SIZE, 8, 3);
+  godot::HeightMap map(CELLS + 1, CELLS + 1, CELL_SIZE, 8, 3);
+
+  for (size_t z : {size_t(0), size_t(5), CELLS / 2, CELLS}) {
+    for (size_t x : {size_t(0), size_t(3), CELLS / 2, CELLS}) {
+      godot::Vector3 v = mesher->vertex(x, z);
+      EXPECT_FLOAT_EQ(map.height(x, z), v.y) << x << " " << z;
+      EXPECT_DOUBLE_EQ((double(x) - CELLS / 2.0) * CELL_SIZE, v.x);
+      EXPECT_DOUBLE_EQ((double(z) - CELLS / 2.0) * CELL_SIZE, v.z);
+    }
+  }
+}
+
+TEST(HeightMapMesherTest, islandIsCenteredOnTheMesh) {
+  constexpr size_t CELLS = 16;
+  godot::Ref<godot::HeightMapMesher> mesher(godot::HeightMapMesher::_new());
+  mesher->generate(CELLS, 3, 8, 0);
+
+  // The falloff reaches 0 at the middle of every edge
+  EXPECT_FLOAT_EQ(0, mesher->vertex(CELLS / 2, 0).y);
+  EXPECT_FLOAT_EQ(0, mesher->vertex(CELLS / 2, CELLS).y);
+  EXPECT_FLOAT_EQ(0, mesher->vertex(0, CELLS / 2).y);
+  EXPECT_FLOAT_EQ(0, mesher->vertex(CELLS, CELLS / 2).y);
+  EXPECT_NE(0, mesher->vertex(CELLS / 2, CELLS / 2).y);
+}
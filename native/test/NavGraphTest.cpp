@@ -0,0 +1,107 @@
+#include <gtest/gtest.h>
+
+#include <vector>
+
+#include "NavGraph.h"
+
+namespace {
+constexpr size_t N = 8;
+
+/**
+ * @brief A chunk of stone up to height(x, z), excluding it. Block 3 is stone.
+ */
+template <typename F>
+godot::NavChunk make_chunk(F height) {
+  std::vector<uint8_t> blocks(N * N * N, 0);
+  for (size_t z = 0; z < N; ++z) {
+    for (size_t x = 0; x < N; ++x) {
+      for (size_t y = 0; y < height(x, z); ++y) {
+        blocks[x + z * N + y * N * N] = 3;
+      }
+    }
+  }
+  godot::NavChunk nav;
+  godot::NavGraph::extract(blocks.data(), godot::RuntimeSize{N}, 2, &nav);
+  godot::VoxelFiller::bottom_air(blocks.data(), godot::RuntimeSize{N},
+                                 &nav.bottom_air);
+  return nav;
+}
+
+godot::NavChunk flat_chunk(size_t height) {
+  return make_chunk([=](size_t, size_t) { return height; });
+}
+
+godot::NavGraph make_graph() {
+  godot::NavGraph graph;
+  graph.configure(N, 2, 1, 3);
+  return graph;
+}
+}  // namespace
+
+TEST(NavGraphTest, extractsExposedTops) {
+  godot::NavChunk nav = flat_chunk(3);
+  ASSERT_EQ(N * N, nav.cells.size());
+  for (size_t i = 0; i < nav.cells.size(); ++i) {
+    EXPECT_EQ(2u, nav.cells[i] / (N * N));
+    EXPECT_EQ(N - 3, nav.headroom[i]);
+  }
+  EXPECT_EQ(0, nav.bottom_air[0]);
+  EXPECT_EQ(N, flat_chunk(0).bottom_air[0]);
+  EXPECT_TRUE(flat_chunk(0).cells.empty());
+}
+
+TEST(NavGraphTest, stitchesNeighbouringChunks) {
+  godot::NavGraph graph = make_graph();
+  graph.add_chunk(0, 0, 0, flat_chunk(3));
+  godot::NavCoord edge{N - 1, 2, 0};
+  EXPECT_EQ(2u, graph.links(edge).size());
+
+  graph.add_chunk(1, 0, 0, flat_chunk(3));
+  EXPECT_EQ(3u, graph.links(edge).size());
+  std::vector<godot::NavCoord> path;
+  ASSERT_TRUE(graph.find_path({0, 2, 0}, {2 * N - 1, 2, 0}, &path));
+  EXPECT_EQ(2 * N, path.size());
+
+  graph.remove_chunk(1, 0, 0);
+  EXPECT_EQ(2u, graph.links(edge).size());
+  EXPECT_EQ(N * N, graph.node_count());
+  EXPECT_FALSE(graph.find_path({0, 2, 0}, {2 * N - 1, 2, 0}, &path));
+}
+
+TEST(NavGraphTest, chunkAboveLimitsHeadroom) {
+  godot::NavGraph graph = make_graph();
+  // The ground is the top layer, so its headroom lies in the chunk above
+  graph.add_chunk(0, 0, 0, flat_chunk(N));
+  EXPECT_EQ(N * N, graph.node_count());
+
+  graph.add_chunk(0, 1, 0, flat_chunk(1));
+  godot::NavCoord below{1, N - 1, 1};
+  godot::NavCoord above{1, N, 1};
+  EXPECT_FALSE(graph.contains(below));
+  EXPECT_TRUE(graph.contains(above));
+
+  graph.remove_chunk(0, 1, 0);
+  EXPECT_TRUE(graph.contains(below));
+  EXPECT_FALSE(graph.contains(above));
+}
+
+TEST(NavGraphTest, stepsUpAndDropsDown) {
+  godot::NavGraph graph = make_graph();
+  // A step of one voxel at x 2, and a wall of two voxels at x 5
+  graph.add_chunk(0, 0, 0, make_chunk([](size_t x, size_t) {
+                    return size_t(x < 2 ? 1 : x < 5 ? 2 : 4);
+                  }));
+  EXPECT_EQ(4u, graph.links({1, 0, 1}).size());
+  EXPECT_EQ(3u, graph.links({4, 1, 1}).size());
+  // The wall can be dropped from, but not climbed
+  EXPECT_EQ(4u, graph.links({5, 3, 1}).size());
+
+  std::vector<godot::NavCoord> path;
+  EXPECT_TRUE(graph.find_path({0, 0, 0}, {4, 1, 0}, &path));
+  EXPECT_FALSE(graph.find_path({0, 0, 0}, {6, 3, 0}, &path));
+  EXPECT_TRUE(graph.find_path({6, 3, 0}, {0, 0, 0}, &path));
+
+  godot::NavCoord node;
+  ASSERT_TRUE(graph.find_node(3, 4, 3, 4, &node));
+  EXPECT_EQ(1, node.y);
+}
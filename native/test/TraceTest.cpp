@@ -0,0 +1,79 @@
+#include <gtest/gtest.h>
+
+#include <cstdio>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+#include "Trace.h"
+
+namespace {
+std::string read_file(const std::string &path) {
+  std::ifstream file(path);
+  std::stringstream contents;
+  contents << file.rdbuf();
+  return contents.str();
+}
+}  // namespace
+
+TEST(TraceTest, nothingIsRecordedWhileStopped) {
+  godot::TraceRecorder &recorder = godot::TraceRecorder::instance();
+  recorder.stop();
+  { godot::TraceScope scope("ignored", 0, 0, 0); }
+
+  std::string path = testing::TempDir() + "trace_stopped.json";
+  ASSERT_TRUE(recorder.write_json(path));
+  EXPECT_EQ(std::string::npos, read_file(path).find("ignored"));
+  std::remove(path.c_str());
+}
+
+TEST(TraceTest, writesEventsOfAllThreads) {
+  godot::TraceRecorder &recorder = godot::TraceRecorder::instance();
+  recorder.start();
+  { godot::TraceScope scope("main_scope", 1, 2, 3); }
+  std::thread worker([&]() {
+    recorder.set_thread_name("worker");
+    recorder.record("worker_instant", 'i', recorder.now(), 0, 4, 5, 6);
+  });
+  worker.join();
+  recorder.stop();
+
+  std::string path = testing::TempDir() + "trace_threads.json";
+  ASSERT_TRUE(recorder.write_json(path));
+  std::string json = read_file(path);
+  EXPECT_NE(std::string::npos,
+            json.find("\"name\":\"main_scope\",\"ph\":\"X\""));
+  EXPECT_NE(std::string::npos, json.find("\"worker_instant\""));
+  EXPECT_NE(std::string::npos, json.find("\"args\":{\"name\":\"worker\"}"));
+  std::remove(path.c_str());
+}
+
+TEST(TraceTest, ringBufferKeepsNewestEvents) {
+  godot::TraceRecorder &recorder = godot::TraceRecorder::instance();
+  recorder.start();
+  recorder.record("oldest", 'i', 0, 0, 0, 0, 0);
+  for (size_t i = 0; i < godot::TraceRecorder::BUFFER_SIZE; ++i) {
+    recorder.record("newer", 'i', 1, 0, 0, 0, 0);
+  }
+  recorder.stop();
+
+  std::string path = testing::TempDir() + "trace_ring.json";
+  ASSERT_TRUE(recorder.write_json(path));
+  EXPECT_EQ(std::string::npos, read_file(path).find("oldest"));
+  std::remove(path.c_str());
+}
+
+TEST(TraceTest, startDropsEventsOfOtherThreads) {
+  godot::TraceRecorder &recorder = godot::TraceRecorder::instance();
+  recorder.start();
+  std::thread worker(
+      [&]() { recorder.record("previous", 'i', recorder.now(), 0, 0, 0, 0); });
+  worker.join();
+  recorder.start();
+  recorder.stop();
+
+  std::string path = testing::TempDir() + "trace_restart.json";
+  ASSERT_TRUE(recorder.write_json(path));
+  EXPECT_EQ(std::string::npos, read_file(path).find("previous"));
+  std::remove(path.c_str());
+}
@@ -0,0 +1,68 @@
+#include <gtest/gtest.h>
+
+#include <sstream>
+
+#include "VoxelStorage.h"
+
+TEST(VoxelStorageTest, uniformChunkUsesNoIndexBits) {
+  std::vector<uint8_t> blocks(4096, 0);
+  godot::VoxelStorage storage;
+  storage.assign(blocks.data(), blocks.size());
+  EXPECT_EQ(0, storage.bits_per_voxel());
+  EXPECT_EQ(0, storage.get(1234));
+}
+
+TEST(VoxelStorageTest, assignRoundTrips) {
+  std::vector<uint8_t> blocks(4096);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    blocks[i] = (i * 7) % 4;
+  }
+  godot::VoxelStorage storage;
+  storage.assign(blocks.data(), blocks.size());
+  EXPECT_EQ(2, storage.bits_per_voxel());
+
+  std::vector<uint8_t> unpacked(blocks.size());
+  storage.unpack(unpacked.data());
+  EXPECT_EQ(blocks, unpacked);
+}
+
+TEST(VoxelStorageTest, setGrowsPalette) {
+  godot::VoxelStorage storage;
+  storage.reset(100);
+  storage.set(3, 2);
+  EXPECT_EQ(1, storage.bits_per_voxel());
+  storage.set(4, 5);
+  storage.set(5, 9);
+  EXPECT_EQ(2, storage.bits_per_voxel());
+  storage.set(6, 11);
+  storage.set(7, 12);
+  EXPECT_EQ(4, storage.bits_per_voxel());
+  EXPECT_EQ(0, storage.get(0));
+  EXPECT_EQ(2, storage.get(3));
+  EXPECT_EQ(5, storage.get(4));
+  EXPECT_EQ(9, storage.get(5));
+  EXPECT_EQ(11, storage.get(6));
+  EXPECT_EQ(12, storage.get(7));
+}
+
+TEST(VoxelStorageTest, writeReadRoundTrips) {
+  std::vector<uint8_t> blocks(4096);
+  for (size_t i = 0; i < blocks.size(); ++i) {
+    blocks[i] = (i * 5) % 3;
+  }
+  godot::VoxelStorage storage;
+  storage.assign(blocks.data(), blocks.size());
+  std::stringstream stream;
+  storage.write(stream);
+
+  godot::VoxelStorage read;
+  ASSERT_TRUE(read.read(stream));
+  std::vector<uint8_t> unpacked(blocks.size());
+  read.unpack(unpacked.data());
+  EXPECT_EQ(blocks, unpacked);
+
+  // Truncated data leaves the storage alone
+  std::stringstream truncated(stream.str().substr(0, 10));
+  EXPECT_FALSE(read.read(truncated));
+  EXPECT_EQ(blocks.size(), read.size());
+}
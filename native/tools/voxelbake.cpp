@@ -0,0 +1,198 @@
+// Bakes a box of chunks into a file Terrain loads instead of generating them.
+// Runs without the engine on all cores, so only the fbm generators, which
+// don't use the engine's noise, are supported. Only voxels are baked, the
+// meshes are built into engine arrays and are created when the chunks load.
+//
+//   voxelbake world.vxb --seed 42 --generator hills --from -32 -3 -32
+//       --to 31 3 31 [--divisions 16] [--chunk-size 16] [--density]
+//       [--threads 8]
+//
+// Rerunning an interrupted bake with the same arguments resumes it.
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "BakedWorld.h"
+#include "FbmGenerator.h"
+#include "VoxelFiller.h"
+#include "VoxelStorage.h"
+
+namespace {
+struct Options {
+  std::string path;
+  godot::BakedWorld::Settings settings;
+  int64_t from[3] = {0, 0, 0};
+  int64_t to[3] = {-1, -1, -1};
+  size_t threads = std::max(1u, std::thread::hardware_concurrency());
+};
+
+struct Coord {
+  int64_t x, y, z;
+};
+
+void print_usage() {
+  std::fprintf(stderr,
+               "usage: voxelbake <file> --seed <n> "
+               "--generator <hills|mountains|canyons>\n"
+               "                 --from <x> <y> <z> --to <x> <y> <z>\n"
+               "                 [--divisions <n>] [--chunk-size <size>] "
+               "[--density] [--threads <n>]\n");
+}
+
+bool parse_generator(const char *name, int32_t *generator) {
+  if (std::strcmp(name, "hills") == 0) {
+    *generator = int32_t(godot::FbmPreset::HILLS);
+  } else if (std::strcmp(name, "mountains") == 0) {
+    *generator = int32_t(godot::FbmPreset::MOUNTAINS);
+  } else if (std::strcmp(name, "canyons") == 0) {
+    *generator = int32_t(godot::FbmPreset::WARPED_CANYONS);
+  } else {
+    return false;
+  }
+  return true;
+}
+
+bool parse_options(int argc, char **argv, Options *options) {
+  if (argc < 2) {
+    return false;
+  }
+  options->path = argv[1];
+  bool has_box = false;
+  for (int i = 2; i < argc; ++i) {
+    std::string arg = argv[i];
+    // The number of values following the flag
+    int remaining = argc - i - 1;
+    if (arg == "--seed" && remaining >= 1) {
+      options->settings.seed = std::atoll(argv[++i]);
+    } else if (arg == "--generator" && remaining >= 1) {
+      if (!parse_generator(argv[++i], &options->settings.generator)) {
+        return false;
+      }
+    } else if (arg == "--from" && remaining >= 3) {
+      for (int64_t &c : options->from) {
+        c = std::atoll(argv[++i]);
+      }
+      has_box = true;
+    } else if (arg == "--to" && remaining >= 3) {
+      for (int64_t &c : options->to) {
+        c = std::atoll(argv[++i]);
+      }
+    } else if (arg == "--divisions" && remaining >= 1) {
+      options->settings.divisions = uint32_t(std::atoi(argv[++i]));
+    } else if (arg == "--chunk-size" && remaining >= 1) {
+      options->settings.chunk_size = std::atof(argv[++i]);
+    } else if (arg == "--density") {
+      options->settings.density = true;
+    } else if (arg == "--threads" && remaining >= 1) {
+      options->threads = size_t(std::max(1, std::atoi(argv[++i])));
+    } else {
+      return false;
+    }
+  }
+  return has_box && options->settings.divisions > 0 &&
+         options->settings.chunk_size > 0;
+}
+}  // namespace
+
+int main(int argc, char **argv) {
+  using namespace std::chrono;
+
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    print_usage();
+    return 1;
+  }
+  const godot::BakedWorld::Settings &settings = options.settings;
+
+  godot::BakedWorld world;
+  if (!world.open_for_append(options.path, settings)) {
+    std::fprintf(stderr,
+                 "Unable to open %s, or it was baked with other settings\n",
+                 options.path.c_str());
+    return 1;
+  }
+
+  // Chunks already in the file are done
+  std::vector<Coord> todo;
+  for (int64_t y = options.from[1]; y <= options.to[1]; ++y) {
+    for (int64_t z = options.from[2]; z <= options.to[2]; ++z) {
+      for (int64_t x = options.from[0]; x <= options.to[0]; ++x) {
+        if (!world.contains(x, y, z)) {
+          todo.push_back(Coord{x, y, z});
+        }
+      }
+    }
+  }
+  std::printf("%zu chunks baked before, %zu to bake on %zu threads\n",
+              world.size(), todo.size(), options.threads);
+
+  std::unique_ptr<godot::TerrainGenerator> generator =
+      godot::create_fbm_generator(godot::FbmPreset(settings.generator),
+                                  uint32_t(settings.seed));
+
+  std::atomic<size_t> next{0};
+  std::atomic<size_t> baked{0};
+  std::atomic<size_t> bytes{0};
+  std::atomic<bool> failed{false};
+  auto bake = [&]() {
+    godot::VoxelFiller filler;
+    godot::VoxelStorage voxels;
+    size_t n = settings.divisions;
+    std::vector<uint8_t> blocks(n * n * n);
+    for (size_t i = next++; i < todo.size() && !failed; i = next++) {
+      const Coord &c = todo[i];
+      filler.sample(generator.get(), c.x * settings.chunk_size,
+                    c.y * settings.chunk_size, c.z * settings.chunk_size,
+                    settings.chunk_size, n, settings.density);
+      filler.fill(blocks.data());
+      voxels.assign(blocks.data(), blocks.size());
+      if (!world.append(c.x, c.y, c.z, voxels)) {
+        failed = true;
+        return;
+      }
+      bytes += voxels.memory_usage();
+      baked++;
+    }
+  };
+
+  steady_clock::time_point start = steady_clock::now();
+  std::vector<std::thread> threads;
+  for (size_t i = 0; i < options.threads; ++i) {
+    threads.emplace_back(bake);
+  }
+
+  // Report the throughput once a second while the workers bake
+  steady_clock::time_point last_report = start;
+  while (baked < todo.size() && !failed) {
+    std::this_thread::sleep_for(milliseconds(50));
+    steady_clock::time_point now = steady_clock::now();
+    if (now - last_report < seconds(1)) {
+      continue;
+    }
+    last_report = now;
+    double elapsed = duration<double>(now - start).count();
+    size_t done = baked;
+    std::printf("%zu / %zu chunks, %.1f chunks/s\n", done, todo.size(),
+                done / elapsed);
+  }
+  for (std::thread &thread : threads) {
+    thread.join();
+  }
+  if (failed) {
+    std::fprintf(stderr, "Writing to %s failed\n", options.path.c_str());
+    return 1;
+  }
+
+  double elapsed = duration<double>(steady_clock::now() - start).count();
+  std::printf("Baked %zu chunks in %.2f s, %.1f chunks/s, %.2f MB of voxels\n",
+              size_t(baked), elapsed, elapsed > 0 ? baked / elapsed : 0.0,
+              bytes / (1024.0 * 1024.0));
+  return 0;
+}
@@ -0,0 +1,105 @@
+extends Spatial
+
+# Flies a camera along a fixed path over a terrain with a fixed seed and
+# writes the terrain streaming statistics to a JSON report. Run it headless:
+#   godot_server --path . --fixed-fps 60 res://Benchmark.tscn --benchmark-output=report.json
+# --fixed-fps makes the path independent of the real frame rate, so runs
+# request the same chunks in the same order.
+
+export var duration: float = 60
+export var speed: float = 30
+export var flight_height: float = 28
+export var hitch_threshold_ms: float = 33.3
+export var output_path: String = "user://benchmark.json"
+
+onready var flyer = get_node("Flyer")
+onready var terrain = get_node("NativeTerrain")
+
+var time: float = 0
+var last_ticks: int = 0
+
+var frame_ms: Array = []
+var process_usec: Array = []
+var latencies_ms: Array = []
+# [time, queue depth, integration queue depth] samples
+var queue_depth: Array = []
+var hitches: int = 0
+
+
+func _ready():
+	for arg in OS.get_cmdline_args():
+		if arg.begins_with("--benchmark-output="):
+			output_path = arg.split("=", true, 1)[1]
+	flyer.transform.origin = path_position(0)
+	last_ticks = OS.get_ticks_usec()
+
+
+func path_position(t: float) -> Vector3:
+	# A straight run with wide turns, so the load volume moves in all directions
+	return Vector3(speed * t, flight_height, 120 * sin(t * 0.15))
+
+
+func _process(delta):
+	var ticks = OS.get_ticks_usec()
+	var ms = (ticks - last_ticks) / 1000.0
+	last_ticks = ticks
+	frame_ms.append(ms)
+	if ms > hitch_threshold_ms:
+		hitches += 1
+
+	var stats: Dictionary = terrain.get_statistics()
+	process_usec.append(stats["process_usec"])
+	for latency in stats["chunk_latencies_ms"]:
+		latencies_ms.append(latency)
+	queue_depth.append([time, stats["queue_depth"], stats["integration_queue_depth"]])
+
+	time += delta
+	var position = path_position(time)
+	# The terrain reads the velocity of the node it follows for prefetching
+	flyer.velocity = (position - flyer.transform.origin) / delta
+	flyer.transform.origin = position
+	flyer.look_at(path_position(time + 1), Vector3.UP)
+
+	if time >= duration:
+		write_report()
+		get_tree().quit()
+
+
+func summarize(values: Array) -> Dictionary:
+	if values.empty():
+		return {}
+	var sorted = values.duplicate()
+	sorted.sort()
+	var total = 0.0
+	for v in sorted:
+		total += v
+	return {
+		"mean": total / sorted.size(),
+		"p50": sorted[int(sorted.size() * 0.5)],
+		"p95": sorted[int(sorted.size() * 0.95)],
+		"p99": sorted[int(sorted.size() * 0.99)],
+		"max": sorted[sorted.size() - 1],
+	}
+
+
+func write_report():
+	var report = {
+		"seed": terrain.get("Seed"),
+		"duration": duration,
+		"frames": frame_ms.size(),
+		"hitch_threshold_ms": hitch_threshold_ms,
+		"hitches": hitches,
+		"frame_ms": summarize(frame_ms),
+		"process_usec": summarize(process_usec),
+		"chunk_latency_ms": summarize(latencies_ms),
+		"chunks_loaded": latencies_ms.size(),
+		"queue_depth": queue_depth,
+		"memory": terrain.get_memory_usage(),
+	}
+	var file = File.new()
+	if file.open(output_path, File.WRITE) != OK:
+		printerr("Unable to write the benchmark report to " + output_path)
+		return
+	file.store_string(to_json(report))
+	file.close()
+	print("Benchmark report written to " + output_path)
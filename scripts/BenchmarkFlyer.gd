@@ -0,0 +1,5 @@
+extends Spatial
+
+# Moved along the benchmark path by Benchmark.gd. Exposes a velocity like the
+# player does, so the terrain can prefetch ahead of it.
+var velocity: Vector3 = Vector3(0, 0, 0)